@@ -2,14 +2,70 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
-#include <windows.h>
+#include <map>
+#include <cstring>
+#include <memory>
 #include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/videoio/videoio.hpp>
+#ifndef KCF_HEADLESS
 #include <opencv2/highgui/highgui.hpp>
-#include "kcftracker.hpp"
+#endif
+#include <thread>
+#include "multikcftracker.hpp"
+#include "matpool.hpp"
+#include "spscqueue.hpp"
+#include "trace.hpp"
 
 using namespace std;
 using namespace cv;
 
+//Side of the square tracked around each vertex of the bottom surface
+#define RECT_W 40
+//Frames processed, the frames after it are ignored
+#define MAX_FRAMES 470
+//Frames buffered between two pipeline stages
+#define QUEUE_SIZE 4
+
+#ifndef KCF_HEADLESS
+//Collects the tracker views on the worker threads and shows them from the main thread,
+//HighGUI must only be called from one thread.
+class HighGuiSink : public DebugSink
+{
+public:
+	virtual void show(const char *name, const void *source, const cv::Mat &image)
+	{
+		cv::Mat view;
+		if (image.depth() == CV_8U)
+			image.copyTo(view);
+		else
+			cv::normalize(image, view, 0.0, 1.0, NORM_MINMAX, CV_32F);
+
+		cv::AutoLock lock(_mutex);
+		std::map<const void*, int>::iterator id = _ids.find(source);
+		if (id == _ids.end())
+			id = _ids.insert(std::make_pair(source, (int)_ids.size())).first;
+		ostringstream window;
+		window << name << " " << id->second;
+		_views[window.str()] = view;
+	}
+
+	//Show the views collected since the last call
+	void flush()
+	{
+		cv::AutoLock lock(_mutex);
+		for (std::map<string, Mat>::iterator it = _views.begin(); it != _views.end(); ++it)
+			imshow(it->first, it->second);
+		_views.clear();
+	}
+
+private:
+	cv::Mutex _mutex;
+	std::map<const void*, int> _ids;
+	std::map<string, Mat> _views;
+};
+#endif
+
 
 //Find the intersection of two sets of line segments, where p1 and p3 form a line segment, p2 and p4 form a line segment
 Point Intersection(Point p1, Point p2, Point p3, Point p4)
@@ -49,68 +105,106 @@ float point2Line(cv::Point2f p1,cv::Point2f lp1,cv::Point2f lp2)
 	return dis;
 }
 
-//Define the tracker
-struct mulTrackers
+//A frame on its way through the pipeline
+struct FrameItem
 {
-	KCFTracker tracker;
-	Rect initRect;
-	Rect resultRect;
-	bool isTracking;
+	int index;
+	Mat rgb;
+	std::shared_ptr<ColorCache> colors;  //gray tiles of rgb, converted where the trackers look
+	vector<TargetResult> targets;  //tracking results, before lost targets are removed
+	bool cone;                     //all four vertices are tracked, draw the cone
 };
 
-int main(int argc, char* argv[]){
+//Decode stage: reads the video. The colour caches come back from the tracking stage through spare,
+//so only the caches of the frames in flight ever exist and their buffers are reused
+void decodeFrames(VideoCapture &capture, SPSCQueue<FrameItem> &out, SPSCQueue<std::shared_ptr<ColorCache> > &spare)
+{
+	for (int frame_cnt = 0; frame_cnt < MAX_FRAMES; frame_cnt++)
+	{
+		FrameItem item;
+		{
+			KCF_TRACE_SCOPE("decode");
+			capture >> item.rgb;
+		}
+		if (item.rgb.empty())
+			break;
+		item.index = frame_cnt;
+		item.cone = false;
+		if (!spare.tryPop(item.colors))
+			item.colors = std::make_shared<ColorCache>();
+		item.colors->reset(item.rgb);
+		out.push(item);
+	}
+	out.close();
+}
 
-	bool HOG = false;
-	bool FIXEDWINDOW = false;
-	bool MULTISCALE = true;
-	bool SILENT = true;
-	bool LAB = false;
+//Tracking stage: the trackers keep state from frame to frame, so frames are tracked in order on one thread
+void trackFrames(MultiKCFTracker &mulTracker, SPSCQueue<FrameItem> &in, SPSCQueue<FrameItem> &out, SPSCQueue<std::shared_ptr<ColorCache> > &spare)
+{
+	int mouse_event_cnt = 0;
+	FrameItem item;
+	while (in.pop(item))
+	{
+		ColorCache &colors = *item.colors;
+		mulTracker.update(colors, ColorCache::GRAY);//Track each tracked object. Used to track the four vertices of the bottom surface of the AR Ling cone
+		item.targets = mulTracker.results();
+		item.cone = mulTracker.size() == 4 && mouse_event_cnt == 4;
 
-	// Create KCFTracker object
-	//KCFTracker tracker(HOG, FIXEDWINDOW, MULTISCALE, LAB);
-	vector<mulTrackers> mulTracker;//Used to store multiple KCF trackers
-	mulTracker.clear();
-	// Frame readed
-	Mat frame_rgb,frame;
+		//Eliminate failed tracking targets
+		mulTracker.removeLost();
 
-	// Tracker results
-	Rect result;
+		if (item.index == 128)//In a specific frame, select 4 points as the four vertices of the bottom surface of the AR Ling cone, as subsequent tracking targets
+		{
+			//New targets are initialized on the whole gray frame
+			Rect whole(0, 0, item.rgb.cols, item.rgb.rows);
+			colors.ensure(ColorCache::GRAY, whole);
+			const Mat &frame = colors.image(ColorCache::GRAY);
 
-	// Frame counter
-	VideoCapture capture("/IMG_0238.mp4");  //Route
+			mulTracker.add(Rect(94-RECT_W/2, 101-RECT_W/2, RECT_W, RECT_W), frame);
+			mouse_event_cnt++;
 
-	cvNamedWindow("Image", CV_WINDOW_NORMAL);
-	cvSetMouseCallback("Image", mouseHandler, NULL);
+			mulTracker.add(Rect(271-RECT_W/2, 126-RECT_W/2, RECT_W, RECT_W), frame);
+			mouse_event_cnt++;
 
-	VideoWriter writer("bikecanny.avi", -1, 10, Size(1920, 1080));
-	int mouse_event_cnt = 0;
-	int frame_cnt = 0;
-	while (1)
-	{
+			mulTracker.add(Rect(272-RECT_W/2, 290-RECT_W/2, RECT_W, RECT_W), frame);
+			mouse_event_cnt++;
 
-		capture >> frame_rgb;
-		cvtColor(frame_rgb,frame,CV_BGR2GRAY);
-		
-		for (int i = 0; i < mulTracker.size(); i++)//Track each tracked object. Used to track the four vertices of the bottom surface of the AR Ling cone
+			mulTracker.add(Rect(94-RECT_W/2, 277-RECT_W/2, RECT_W, RECT_W), frame);
+			mouse_event_cnt++;
+		}
+
+		cout <<item.index + 1<<endl;
+		spare.push(item.colors);
+		item.colors.reset();
+		out.push(item);
+	}
+	out.close();
+}
+
+//Overlay stage: draws the tracked vertices and the cone
+void renderFrames(SPSCQueue<FrameItem> &in, SPSCQueue<FrameItem> &out)
+{
+	FrameItem item;
+	while (in.pop(item))
+	{
+		KCF_TRACE_SCOPE("render");
+		Mat &frame_rgb = item.rgb;
+		const vector<TargetResult> &targets = item.targets;
+		for (size_t i = 0; i < targets.size(); i++)
 		{
-			bool tracked = mulTracker[i].tracker.update(frame);
-			mulTracker[i].isTracking = tracked;
-			mulTracker[i].resultRect = mulTracker[i].tracker.getRect();
-			if (tracked && mulTracker.size() == 4)
-			{
-				cv::circle(frame_rgb,Point(mulTracker[i].resultRect.x + RECT_W/2,mulTracker[i].resultRect.y + RECT_W/2),8,CV_RGB(0,255,0),2);
-			}
-			else
+			const TargetResult &res = targets[i];
+			if (res.status == TARGET_TRACKING && targets.size() == 4)
 			{
+				cv::circle(frame_rgb,Point(res.rect.x + RECT_W/2,res.rect.y + RECT_W/2),8,CV_RGB(0,255,0),2);
 			}
 		}
 		
-		if(mulTracker.size() == 4 && mouse_event_cnt == 4)//The edges and vertices of the cone are superimposed on the image, of which the bottom 4 uses multi-target tracking, real-time tracking; the vertices are obtained by calculation.
+		if(item.cone)//The edges and vertices of the cone are superimposed on the image, of which the bottom 4 uses multi-target tracking, real-time tracking; the vertices are obtained by calculation.
 		{
-			Point p0 = Point(mulTracker[0].resultRect.x + RECT_W/2,mulTracker[0].resultRect.y + RECT_W/2);//Vertex coordinates of the bottom surface of the Ling cone
-			Point p1 = Point(mulTracker[1].resultRect.x + RECT_W/2,mulTracker[1].resultRect.y + RECT_W/2);
-			Point p2 = Point(mulTracker[2].resultRect.x + RECT_W/2,mulTracker[2].resultRect.y + RECT_W/2);
-			Point p3 = Point(mulTracker[3].resultRect.x + RECT_W/2,mulTracker[3].resultRect.y + RECT_W/2);
+			Point p0 = Point(targets[0].rect.x + RECT_W/2,targets[0].rect.y + RECT_W/2);//Vertex coordinates of the bottom surface of the Ling cone
+			Point p1 = Point(targets[1].rect.x + RECT_W/2,targets[1].rect.y + RECT_W/2);
+			Point p2 = Point(targets[2].rect.x + RECT_W/2,targets[2].rect.y + RECT_W/2);
+			Point p3 = Point(targets[3].rect.x + RECT_W/2,targets[3].rect.y + RECT_W/2);
 			line(frame_rgb, p0, p1, Scalar(0, 0, 255), 2, 8);//Draw a rectangle on the bottom
 			line(frame_rgb, p1, p2, Scalar(0, 0, 255), 2, 8);
 			line(frame_rgb, p2, p3, Scalar(0, 0, 255), 2, 8);
@@ -119,11 +213,8 @@ int main(int argc, char* argv[]){
 			Point insec = Intersection(p0,p1,p2,p3);//Midpoint of bottom coordinate
 			//cv::circle(frame_rgb,insec,8,CV_RGB(0,0,255),2);
 			float Rh = 0.0;
-			float Rv = 0.0;
 			float l_right = sqrt((float)(p1.x - p2.x)*(p1.x - p2.x) + (p1.y - p2.y) * (p1.y - p2.y));
 			float l_left = sqrt((float)(p3.x - p0.x) * (p3.x - p0.x) + (p3.y - p0.y) * (p3.y - p0.y));
-			float l_up = sqrt((float)(p1.x - p0.x) * (p1.x - p0.x) + (p1.y - p0.y) * (p1.y - p0.y));
-			float l_down = sqrt((float)(p2.x - p3.x) * (p2.x - p3.x) + (p2.y - p3.y) * (p2.y - p3.y));
 			float tmp = point2Line(p0,p1,p2) / max(l_left, l_right);
 			cout <<tmp<<endl;
 			if(tmp >= 1.0) tmp = 1.0;
@@ -141,75 +232,115 @@ int main(int argc, char* argv[]){
 			line(frame_rgb, p2, top, Scalar(0, 0, 255), 2, 8);
 			line(frame_rgb, p3, top, Scalar(0, 0, 255), 2, 8);
 			cv::circle(frame_rgb,top,8,CV_RGB(0,255,255),2);
-		}		
-		//Eliminate failed tracking targets
-		vector<mulTrackers>::iterator itc;
-		itc = mulTracker.begin();
-		while (itc != mulTracker.end())
-		{
-			if (itc->isTracking == false)
-				itc = mulTracker.erase(itc);
-			else
-				++itc;
 		}
+		out.push(item);
+	}
+	out.close();
+}
 
-		if (frame_cnt == 128)//In a specific frame, select 4 points as the four vertices of the bottom surface of the AR Ling cone, as subsequent tracking targets
-		{
-			mulTrackers multiTracker_tmp;
-			KCFTracker tracker_tmp(HOG, FIXEDWINDOW, MULTISCALE, LAB);
-			multiTracker_tmp.tracker = tracker_tmp;
-			multiTracker_tmp.initRect = Rect(94-RECT_W/2, 101-RECT_W/2, RECT_W, RECT_W);//
-
-			mulTracker.push_back(multiTracker_tmp);			
-			int m = mulTracker.size();
-			mulTracker[m - 1].tracker.init(mulTracker[m - 1].initRect, frame);
-		
+int main(int argc, char* argv[]){
 
-			//gotBB = false;
-			mouse_event_cnt++;
-			
-			mulTrackers multiTracker_tmp1;
-			KCFTracker tracker_tmp1(HOG, FIXEDWINDOW, MULTISCALE, LAB);
-			multiTracker_tmp1.tracker = tracker_tmp1;
-			multiTracker_tmp1.initRect = Rect(271-RECT_W/2, 126-RECT_W/2, RECT_W, RECT_W);
+	bool HOG = false;
+	bool FIXEDWINDOW = false;
+	bool MULTISCALE = true;
+	bool LAB = false;
+	bool SHOW = false;   //--show: display the result frames
+	bool DEBUG = false;  //--debug: also display the intermediate images of every target
+	const char *video = "/IMG_0238.mp4";  //Route, can be given on the command line
+	const char *trace = NULL;  //--trace FILE: write a Chrome trace of the tracking
+	MotionModelType motion = MOTION_NONE;  //--motion cv|kalman: search the vertices around their predicted position
 
-			mulTracker.push_back(multiTracker_tmp1);			
-			m = mulTracker.size();
-			mulTracker[m - 1].tracker.init(mulTracker[m - 1].initRect, frame);
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--show") == 0)
+			SHOW = true;
+		else if (strcmp(argv[i], "--debug") == 0)
+			SHOW = DEBUG = true;
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			trace = argv[++i];
+		else if (strcmp(argv[i], "--motion") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "cv") == 0)
+				motion = MOTION_CONSTANT_VELOCITY;
+			else if (strcmp(argv[i], "kalman") == 0)
+				motion = MOTION_KALMAN;
+		}
+		else
+			video = argv[i];
+	}
+#ifdef KCF_HEADLESS
+	if (SHOW)
+		cout << "built without HighGUI, --show and --debug are ignored" << endl;
+	SHOW = DEBUG = false;
+#endif
 
-			mouse_event_cnt++;
-			
-			mulTrackers multiTracker_tmp2;
-			KCFTracker tracker_tmp2(HOG, FIXEDWINDOW, MULTISCALE, LAB);
-			multiTracker_tmp2.tracker = tracker_tmp2;
-			multiTracker_tmp2.initRect = Rect(272-RECT_W/2, 290-RECT_W/2, RECT_W, RECT_W);
-
-			mulTracker.push_back(multiTracker_tmp2);			
-			m = mulTracker.size();
-			mulTracker[m - 1].tracker.init(mulTracker[m - 1].initRect, frame);
-			
-			mouse_event_cnt++;
-			
-			mulTrackers multiTracker_tmp3;
-			KCFTracker tracker_tmp3(HOG, FIXEDWINDOW, MULTISCALE, LAB);
-			multiTracker_tmp3.tracker = tracker_tmp3;
-			multiTracker_tmp3.initRect = Rect(94-RECT_W/2, 277-RECT_W/2, RECT_W, RECT_W);
+	// Create KCFTracker object
+	//KCFTracker tracker(HOG, FIXEDWINDOW, MULTISCALE, LAB);
+	MultiKCFTracker mulTracker(HOG, FIXEDWINDOW, MULTISCALE, LAB);//Used to store multiple KCF trackers, updated in parallel
+	mulTracker.setMotionModel(motion);
+	// Tracker results
+	Rect result;
 
-			mulTracker.push_back(multiTracker_tmp3);			
-			m = mulTracker.size();
-			mulTracker[m - 1].tracker.init(mulTracker[m - 1].initRect, frame);
+	if (trace != NULL)
+		Trace::setEnabled(true);
 
-			mouse_event_cnt++;
-		}
+	//Frames, gray buffers and the tracker's windows, spectra and kernels have the same sizes from one
+	//frame to the next: recycle their buffers instead of going through the system allocator
+	MatPool::install(&MatPool::instance());
 
+	// Frame counter
+	VideoCapture capture(video);
+	if (!capture.isOpened())
+	{
+		cout << "cannot open " << video << endl;
+		return 1;
+	}
 
-		frame_cnt++;
-		cout <<frame_cnt<<endl;
-		if(frame_cnt>= 471)break;
-		imshow("Image", frame_rgb);
+#ifndef KCF_HEADLESS
+	HighGuiSink debugSink;
+	if (SHOW)
+		namedWindow("Image", WINDOW_NORMAL);
+	if (DEBUG)
+		mulTracker.setDebugSink(&debugSink);
+#endif
+
+	//Decode, tracking and overlay run on their own threads, connected by bounded queues; this thread
+	//encodes (and displays, HighGUI stays on one thread). Each queue has one producer and one
+	//consumer, so frames stay in order, and a full queue stalls the stages before it.
+	//There is no colour conversion stage: the trackers convert the tiles under their windows to gray
+	//themselves, most of the frame is never converted.
+	SPSCQueue<FrameItem> decoded(QUEUE_SIZE), tracked(QUEUE_SIZE), rendered(QUEUE_SIZE);
+	//one cache per frame between decode and tracking: the decoded queue, plus one in each stage
+	SPSCQueue<std::shared_ptr<ColorCache> > spareColors(QUEUE_SIZE + 2);
+	std::thread decoder(decodeFrames, std::ref(capture), std::ref(decoded), std::ref(spareColors));
+	std::thread trackerThread(trackFrames, std::ref(mulTracker), std::ref(decoded), std::ref(tracked), std::ref(spareColors));
+	std::thread renderer(renderFrames, std::ref(tracked), std::ref(rendered));
+
+	VideoWriter writer;
+	FrameItem item;
+	while (rendered.pop(item))
+	{
+		KCF_TRACE_SCOPE("encode");
+		const Mat &frame_rgb = item.rgb;
+		if (!writer.isOpened())
+			writer.open("bikecanny.avi", VideoWriter::fourcc('M', 'J', 'P', 'G'), 10, frame_rgb.size());
+#ifndef KCF_HEADLESS
+		if (SHOW)
+		{
+			imshow("Image", frame_rgb);
+			debugSink.flush();
+			waitKey(1);
+		}
+#endif
 		writer << frame_rgb;
 	}
+	decoder.join();
+	trackerThread.join();
+	renderer.join();
 
+	if (trace != NULL && !Trace::writeChromeTrace(trace))
+		cout << "cannot write " << trace << endl;
 	return 0;
 
 }
@@ -0,0 +1,138 @@
+#include "colorcache.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using namespace std;
+using namespace cv;
+
+ColorCache::ColorCache()
+    : _tilesX(0), _tilesY(0), _converted(0)
+{
+    for (int s = 0; s < SPACES; s++)
+        _created[s].store(false, std::memory_order_relaxed);
+}
+
+void ColorCache::reset(const cv::Mat &frame)
+{
+    CV_Assert(frame.depth() == CV_8U && (frame.channels() == 3 || frame.channels() == 1));
+    int tilesX = (frame.cols + TILE - 1) / TILE;
+    int tilesY = (frame.rows + TILE - 1) / TILE;
+    if (tilesX != _tilesX || tilesY != _tilesY)
+    {
+        for (int s = 0; s < SPACES; s++)
+        {
+            std::vector<std::atomic<int> > tiles(tilesX * tilesY);
+            _tiles[s].swap(tiles);
+        }
+        _tilesX = tilesX;
+        _tilesY = tilesY;
+    }
+    for (int s = 0; s < SPACES; s++)
+    {
+        for (size_t i = 0; i < _tiles[s].size(); i++)
+            _tiles[s][i].store(TILE_EMPTY, std::memory_order_relaxed);
+    }
+    _converted.store(0, std::memory_order_relaxed);
+
+    // a gray frame was its own GRAY image, do not convert into it
+    if (_images[BGR].channels() == 1)
+        _images[GRAY].release();
+    for (int s = 0; s < SPACES; s++)
+        _created[s].store(false, std::memory_order_relaxed);
+
+    _images[BGR] = frame;
+    _created[BGR].store(true, std::memory_order_relaxed);
+    if (frame.channels() == 1)
+    {
+        _images[GRAY] = frame;
+        _created[GRAY].store(true, std::memory_order_relaxed);
+        for (size_t i = 0; i < _tiles[GRAY].size(); i++)
+            _tiles[GRAY][i].store(TILE_DONE, std::memory_order_relaxed);
+    }
+}
+
+void ColorCache::create(Space space) const
+{
+    if (_created[space].load(std::memory_order_acquire))
+        return;
+    std::lock_guard<std::mutex> lock(_create);
+    if (_created[space].load(std::memory_order_relaxed))
+        return;
+    // create() keeps the buffer of the previous frame when the size did not change
+    static const int types[SPACES] = {CV_8UC3, CV_8U, CV_32FC3};
+    _images[space].create(_images[BGR].size(), types[space]);
+    _created[space].store(true, std::memory_order_release);
+}
+
+void ColorCache::ensure(Space space, const cv::Rect_<float> &region) const
+{
+    const cv::Mat &frame = _images[BGR];
+    if (space == BGR || frame.empty())
+        return;
+
+    // pixels read by a window over region, at least the nearest one when region is outside
+    int x0 = std::min(std::max((int)std::floor(region.x), 0), frame.cols - 1);
+    int y0 = std::min(std::max((int)std::floor(region.y), 0), frame.rows - 1);
+    int x1 = std::max(std::min((int)std::ceil(region.x + region.width) + 1, frame.cols), x0 + 1);
+    int y1 = std::max(std::min((int)std::ceil(region.y + region.height) + 1, frame.rows), y0 + 1);
+
+    create(space);
+    std::vector<std::atomic<int> > &tiles = _tiles[space];
+    for (int ty = y0 / TILE; ty <= (y1 - 1) / TILE; ty++)
+    {
+        for (int tx = x0 / TILE; tx <= (x1 - 1) / TILE; tx++)
+        {
+            std::atomic<int> &state = tiles[ty * _tilesX + tx];
+            if (state.load(std::memory_order_acquire) == TILE_DONE)
+                continue;
+            int expected = TILE_EMPTY;
+            if (state.compare_exchange_strong(expected, TILE_BUSY, std::memory_order_acquire))
+            {
+                cv::Rect tile(tx * TILE, ty * TILE, TILE, TILE);
+                convert(space, tile & cv::Rect(0, 0, frame.cols, frame.rows));
+                _converted.fetch_add(1, std::memory_order_relaxed);
+                state.store(TILE_DONE, std::memory_order_release);
+                continue;
+            }
+            // another thread converts it
+            while (state.load(std::memory_order_acquire) != TILE_DONE)
+                std::this_thread::yield();
+        }
+    }
+}
+
+void ColorCache::convert(Space space, const cv::Rect &tile) const
+{
+    KCF_TRACE_SCOPE("ColorCache::convert");
+    cv::Mat bgr = _images[BGR](tile);
+    cv::Mat dst = _images[space](tile); // writes into the full-size buffer, no reallocation
+    if (bgr.channels() == 1)
+    {
+        cv::Mat gray = bgr;
+        cv::cvtColor(gray, bgr, cv::COLOR_GRAY2BGR);
+    }
+    if (space == GRAY)
+    {
+        cv::cvtColor(bgr, dst, cv::COLOR_BGR2GRAY);
+    }
+    else if (space == HSV)
+    {
+        // same steps as img2hsv()
+        cv::Mat bgrf;
+        bgr.convertTo(bgrf, CV_32FC3, 1.0 / 255.0);
+        cv::cvtColor(bgrf, dst, cv::COLOR_BGR2HSV);
+    }
+}
+
+const cv::Mat &ColorCache::image(Space space) const
+{
+    create(space);
+    return _images[space];
+}
+
+int ColorCache::convertedTiles() const
+{
+    return _converted.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,99 @@
+/*
+
+Per-frame colour conversions, computed lazily by tiles.
+
+The trackers only read windows around their targets, yet converting the whole
+frame to gray (or HSV for the histogram check) costs as much as the tracking of
+a few targets on large frames. A ColorCache wraps one BGR frame and holds a
+full-size buffer per colour space, divided in TILE x TILE tiles. A buffer is
+only allocated by the first ensure() or image() of its space, so a cache that
+only serves gray windows never holds an HSV buffer. ensure() converts the tiles a
+region touches that have not been converted yet; the other tiles of the buffer
+are left undefined. Tiles are shared by all readers of the frame, whatever
+tracker or colour space consumer asked for them first.
+
+    ColorCache cache;
+    cache.reset(frame_bgr);                              // once per frame, nothing converted
+    cache.ensure(ColorCache::GRAY, window);              // converts the tiles under window
+    const cv::Mat &gray = cache.image(ColorCache::GRAY); // valid inside the ensured regions
+
+Conversions are per pixel, so a tile holds exactly what a full-frame cvtColor
+would have produced there:
+    GRAY  8-bit, cv::COLOR_BGR2GRAY
+    HSV   32-bit float, like img2hsv() (H in degrees, S and V in [0, 1])
+
+There is no Lab space: the Lab features of KCFTracker are computed on the
+resampled window, which is not the resampled Lab frame.
+
+ensure() is thread safe: every tile is converted once, by the first thread that
+needs it, and other threads needing it wait for that conversion. image() is
+thread safe too. reset() must not run concurrently with anything else. A single
+channel frame is its own GRAY image.
+
+The buffers are kept by reset() while the frame size does not change, so a
+cache reused from frame to frame does not allocate again. Reuse a few caches
+rather than creating one per frame: a pipeline needs one per frame in flight.
+
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#ifndef _COLORCACHE_HPP_
+#define _COLORCACHE_HPP_
+#endif
+
+class ColorCache
+{
+public:
+    enum Space
+    {
+        BGR = 0, // the frame itself
+        GRAY,
+        HSV,
+        SPACES
+    };
+
+    static const int TILE = 64;
+
+    ColorCache();
+
+    // Start a new frame, no tile converted. frame is referenced, not copied.
+    void reset(const cv::Mat &frame);
+
+    // Convert the tiles of space under region (image coordinates, clipped to the frame). A region
+    // outside the frame converts the nearest border pixels, which replicated borders read.
+    void ensure(Space space, const cv::Rect_<float> &region) const;
+
+    // Full-size buffer of space, valid inside the ensured regions
+    const cv::Mat &image(Space space) const;
+
+    // Tiles converted since reset(), all spaces together
+    int convertedTiles() const;
+
+private:
+    ColorCache(const ColorCache &);
+    ColorCache &operator=(const ColorCache &);
+
+    void convert(Space space, const cv::Rect &tile) const;
+    void create(Space space) const;
+
+    enum TileState
+    {
+        TILE_EMPTY = 0,
+        TILE_BUSY,
+        TILE_DONE
+    };
+
+    mutable cv::Mat _images[SPACES];            // created by the first use of the space
+    mutable std::atomic<bool> _created[SPACES]; // _images[space] is ready for this frame
+    mutable std::mutex _create;
+    mutable std::vector<std::atomic<int> > _tiles[SPACES]; // TileState of every tile, row major
+    int _tilesX, _tilesY;
+    mutable std::atomic<int> _converted;
+};
@@ -0,0 +1,38 @@
+/*
+
+Optional receiver of the tracker's intermediate images.
+
+The tracker library never opens a window: HighGUI is not thread-safe (targets are
+updated on worker threads) and servers have no display. Instead, a DebugSink can
+be attached to a KCFTracker (or to all targets of a MultiKCFTracker). The tracker
+hands it its intermediate images; without a sink the only cost is a null pointer
+test, and the views are not even computed.
+
+Views currently published:
+    "FeaturesMap"  features of every extracted window (one plane per row)
+    "response"     detection response of every scale probe
+    "PSR_mask"     sidelobe mask used for the peak-to-sidelobe ratio
+    "x", "T"       gray window at the new position and initial template
+
+show() is called from the thread that updates the tracker, so a sink shared by
+several targets of a MultiKCFTracker must be thread-safe. The image is only valid
+during the call; copy it to keep it.
+
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+#ifndef _DEBUGSINK_HPP_
+#define _DEBUGSINK_HPP_
+#endif
+
+class DebugSink
+{
+public:
+    virtual ~DebugSink() {}
+
+    // name identifies the view, source the tracker that produced it
+    virtual void show(const char *name, const void *source, const cv::Mat &image) = 0;
+};
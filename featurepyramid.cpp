@@ -0,0 +1,169 @@
+#include "featurepyramid.hpp"
+#include "recttools.hpp"
+#include "fhog.hpp"
+#include "trace.hpp"
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+FeaturePyramid::FeaturePyramid()
+    : _cell_size(4), _level_step(1.1f)
+{
+}
+
+void FeaturePyramid::reset(int cell_size, float level_step)
+{
+    _cell_size = cell_size;
+    _level_step = level_step > 1.0f ? level_step : 1.1f; // single scale trackers still need a grid of levels
+    _levels.clear();
+}
+
+int FeaturePyramid::levelIndex(float scale) const
+{
+    return cvRound(std::log(scale) / std::log(_level_step));
+}
+
+const FeaturePyramid::Level *FeaturePyramid::findLevel(int index) const
+{
+    for (size_t i = 0; i < _levels.size(); i++)
+    {
+        if (_levels[i].index == index)
+            return &_levels[i];
+    }
+    return NULL;
+}
+
+void FeaturePyramid::require(const cv::Point2f &center, const cv::Size &tmpl_sz, float scale)
+{
+    int index = levelIndex(scale);
+    Level *level = NULL;
+    for (size_t i = 0; i < _levels.size(); i++)
+    {
+        if (_levels[i].index == index)
+            level = &_levels[i];
+    }
+    if (level == NULL)
+    {
+        Level l;
+        l.index = index;
+        l.scale = std::pow(_level_step, (float)index);
+        l.x0 = l.y0 = FLT_MAX;
+        l.x1 = l.y1 = -FLT_MAX;
+        l.rx = l.ry = l.mapX = l.mapY = 0;
+        _levels.push_back(l);
+        level = &_levels.back();
+    }
+
+    // the window is sampled at the level resolution, so it spans tmpl_sz level pixels
+    float cx = center.x / level->scale;
+    float cy = center.y / level->scale;
+    level->x0 = std::min(level->x0, cx - tmpl_sz.width * 0.5f);
+    level->y0 = std::min(level->y0, cy - tmpl_sz.height * 0.5f);
+    level->x1 = std::max(level->x1, cx + tmpl_sz.width * 0.5f);
+    level->y1 = std::max(level->y1, cy + tmpl_sz.height * 0.5f);
+}
+
+void FeaturePyramid::build(const cv::Mat &image, const ColorCache *cache, ColorCache::Space space)
+{
+    KCF_TRACE_SCOPE("FeaturePyramid::build");
+    const int quantum = 4 * _cell_size; // region sizes are rounded up to it
+    for (size_t i = 0; i < _levels.size(); i++)
+    {
+        Level &level = _levels[i];
+        level.mapX = level.mapY = 0;
+
+        // region on the cell grid, one cell of margin for the snapping of the windows
+        level.rx = (int)std::floor(level.x0 / _cell_size) * _cell_size - _cell_size;
+        level.ry = (int)std::floor(level.y0 / _cell_size) * _cell_size - _cell_size;
+        int rw = (int)std::ceil(level.x1 / _cell_size) * _cell_size + _cell_size - level.rx;
+        int rh = (int)std::ceil(level.y1 / _cell_size) * _cell_size + _cell_size - level.ry;
+
+        // keep the size of the previous frame while the windows still fit and it is less than
+        // a quantum too large, otherwise round up for the next frames
+        Region &region = _regions[level.index];
+        FHogWorkspace *ws = region.fhog.ws;
+        if (ws != NULL && ws->k == _cell_size && ws->width >= rw && ws->height >= rh &&
+            ws->width - rw <= quantum && ws->height - rh <= quantum)
+        {
+            rw = ws->width;
+            rh = ws->height;
+        }
+        else
+        {
+            rw = cv::alignSize(rw, quantum);
+            rh = cv::alignSize(rh, quantum);
+        }
+
+        cv::Rect src(cvRound(level.rx * level.scale), cvRound(level.ry * level.scale),
+                     cvRound(rw * level.scale), cvRound(rh * level.scale));
+        if ((src & cv::Rect(0, 0, image.cols, image.rows)).area() <= 0)
+            continue;
+
+        cv::Rect_<float> window(level.rx * level.scale, level.ry * level.scale, rw * level.scale, rh * level.scale);
+        if (cache)
+            cache->ensure(space, window);
+        RectTools::sampleWindow(image, window, cv::Size(rw, rh), region.fhog.patch, region.taps);
+
+        cv::Mat &z = region.fhog.patch;
+        if (ws == NULL || ws->k != _cell_size || ws->width != z.cols || ws->height != z.rows ||
+            ws->numChannels != z.channels())
+        {
+            freeFHogWorkspace(&region.fhog.ws);
+            allocFHogWorkspace(&region.fhog.ws, z.cols, z.rows, _cell_size, z.channels());
+            ws = region.fhog.ws;
+        }
+        IplImage z_ipl = fhogIplImage(z);
+        getFeatureMapsFast(&z_ipl, ws);
+        normalizeAndPCAFeatureMaps(ws, 0.2f);
+        level.mapX = ws->map.sizeX;
+        level.mapY = ws->map.sizeY;
+    }
+}
+
+bool FeaturePyramid::sample(const cv::Point2f &center, const cv::Size &tmpl_sz, float scale, const cv::Mat &hann,
+                            cv::Mat &dst, cv::Point2f &used_center, float &used_scale) const
+{
+    const Level *level = findLevel(levelIndex(scale));
+    if (level == NULL || level->mapX == 0)
+        return false;
+    std::map<int, Region>::const_iterator region = _regions.find(level->index);
+    if (region == _regions.end() || region->second.fhog.ws == NULL)
+        return false;
+    const float *cells = region->second.fhog.ws->map.map;
+
+    const int numFeatures = NUM_SECTOR * 3 + 4;
+    int nx = tmpl_sz.width / _cell_size - 2;
+    int ny = tmpl_sz.height / _cell_size - 2;
+
+    // Output cell j of a window whose origin is on the grid at region cell ox is output cell
+    // ox + j of the region, as both drop their first cell in normalization.
+    int ox = cvRound((center.x / level->scale - tmpl_sz.width * 0.5f - level->rx) / _cell_size);
+    int oy = cvRound((center.y / level->scale - tmpl_sz.height * 0.5f - level->ry) / _cell_size);
+    if (ox < 0 || oy < 0 || ox + nx > level->mapX || oy + ny > level->mapY)
+        return false;
+
+    const float *window = hann.ptr<float>();
+    float *planes = dst.ptr<float>();
+    size_t planeStep = dst.step1();
+    for (int iy = 0; iy < ny; iy++)
+    {
+        const float *cell = cells + ((oy + iy) * level->mapX + ox) * numFeatures;
+        for (int ix = 0; ix < nx; ix++, cell += numFeatures)
+        {
+            int c = iy * nx + ix;
+            for (int f = 0; f < numFeatures; f++)
+                planes[f * planeStep + c] = cell[f] * window[c];
+        }
+    }
+
+    used_center.x = (level->rx + ox * _cell_size + tmpl_sz.width * 0.5f) * level->scale;
+    used_center.y = (level->ry + oy * _cell_size + tmpl_sz.height * 0.5f) * level->scale;
+    used_scale = level->scale;
+    return true;
+}
+
+int FeaturePyramid::levels() const
+{
+    return (int)_levels.size();
+}
@@ -0,0 +1,92 @@
+/*
+
+Per-frame fhog feature pyramid shared by several KCFTrackers.
+
+Every scale probe of every target normally crops, resizes and extracts its own
+HOG window. When the search windows overlap (the cone vertices are close to each
+other), most of this work is done several times on the same pixels. The pyramid
+computes fhog cells once per frame at a few levels, over the union of the
+windows that were announced with require(), and the trackers copy their windows
+out of it.
+
+Levels are powers of level_step: a window at scale s (image pixels per template
+pixel) is sampled from the level whose scale is closest to s, on that level's
+cell grid. The window actually used is therefore snapped to a cell of the level
+and its scale rounded to the level scale; sample() reports both so the tracker
+can place the detection correctly.
+
+Usage, once per frame:
+    pyramid.reset(cell_size, scale_step);
+    pyramid.require(center, tmpl_sz, scale);   // for every window to be sampled
+    pyramid.build(frame);
+    pyramid.sample(...);                       // thread safe, any number of times
+
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <map>
+#include <vector>
+#include "colorcache.hpp"
+#include "recttools.hpp"
+#include "fhog.hpp"
+
+#ifndef _FEATUREPYRAMID_HPP_
+#define _FEATUREPYRAMID_HPP_
+#endif
+
+class FeaturePyramid
+{
+public:
+    FeaturePyramid();
+
+    // Start a new frame, dropping the levels of the previous one
+    void reset(int cell_size, float level_step);
+
+    // Announce a window of template size tmpl_sz centered on center, at scale (image pixels per
+    // template pixel). build() only computes the levels and regions that were required.
+    void require(const cv::Point2f &center, const cv::Size &tmpl_sz, float scale);
+
+    // Compute the fhog cells of all required regions on this frame. With a cache, image is
+    // cache->image(space) and only the regions read are converted.
+    void build(const cv::Mat &image, const ColorCache *cache = NULL, ColorCache::Space space = ColorCache::GRAY);
+
+    // Copy the features of a window into dst, one channel plane per row (dst must have
+    // NUM_SECTOR * 3 + 4 rows and at least as many columns as the window has cells), each cell
+    // multiplied by its weight in hann. used_center and used_scale receive the window that was
+    // really sampled. Returns false if the window is not covered by the built regions.
+    bool sample(const cv::Point2f &center, const cv::Size &tmpl_sz, float scale, const cv::Mat &hann,
+                cv::Mat &dst, cv::Point2f &used_center, float &used_scale) const;
+
+    // Number of levels built for the current frame
+    int levels() const;
+
+private:
+    struct Level
+    {
+        int index;        // level scale is level_step^index
+        float scale;
+        float x0, y0, x1, y1; // bounds of the required windows, in level pixels
+        int rx, ry;       // region origin in level pixels, on the cell grid
+        int mapX, mapY;   // fhog cells of the region, 0 while it is not built
+    };
+
+    // Buffers of the region of a level index. They are kept across reset(), regions keep their
+    // size while the windows move a little, so a workspace is only reallocated when its region
+    // really grows or shrinks.
+    struct Region
+    {
+        FHogWorkspaceHandle fhog; // ws->map holds mapY rows of mapX cells, NUM_SECTOR * 3 + 4 features per cell
+        RectTools::SampleTaps taps;
+    };
+
+    int levelIndex(float scale) const;
+    const Level *findLevel(int index) const;
+
+    int _cell_size;
+    float _level_step;
+    std::vector<Level> _levels;
+    std::map<int, Region> _regions; // by level index
+};
@@ -41,150 +41,739 @@ the use of this software, even if advised of the possibility of such damage.
 #define _OPENCV_FFTTOOLS_HPP_
 #endif
 
-//NOTE: FFTW support is still shaky, disabled for now.
-/*#ifdef USE_FFTW
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FFTTOOLS_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FFTTOOLS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FFTTOOLS_NEON
+#endif
+
+// Define USE_FFTW (and link fftw3f) to run the packed real transforms with FFTW instead of cv::dft.
+#include <algorithm>
+#include <memory>
+#include <string>
+#ifdef USE_FFTW
 #include <fftw3.h>
-#endif*/
+#include <cstring>
+#include <map>
+#endif
 
 namespace FFTTools
 {
 // Previous declarations, to avoid warnings
-cv::Mat fftd(cv::Mat img, bool backwards = false);
-cv::Mat real(cv::Mat img);
-cv::Mat imag(cv::Mat img);
-cv::Mat magnitude(cv::Mat img);
-cv::Mat complexMultiplication(cv::Mat a, cv::Mat b);
-cv::Mat complexDivision(cv::Mat a, cv::Mat b);
-void rearrange(cv::Mat &img);
-void normalizedLogTransform(cv::Mat &img);
+inline cv::Mat fftd(cv::Mat img, bool backwards = false);
+inline cv::Mat real(cv::Mat img);
+inline cv::Mat imag(cv::Mat img);
+inline cv::Mat magnitude(cv::Mat img);
+inline cv::Mat complexMultiplication(cv::Mat a, cv::Mat b);
+inline void complexMultiplication(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst, bool conjB = false);
+inline cv::Mat complexDivision(cv::Mat a, cv::Mat b);
+inline void complexDivision(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst);
+inline cv::Mat fftdPacked(cv::Mat img, bool backwards = false);
+inline void fftdPacked(const cv::Mat &img, cv::Mat &dst, bool backwards = false);
+inline cv::Mat complexMultiplicationPacked(cv::Mat a, cv::Mat b, bool conjB = false);
+inline void complexMultiplicationPacked(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst, bool conjB = false);
+inline cv::Mat complexDivisionPacked(cv::Mat a, cv::Mat b);
+inline void complexDivisionPacked(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst);
+inline void accumulatePowerSpectrumPacked(const cv::Mat &a, cv::Mat &dst);
+inline void regularizeKernelSpectrumPacked(cv::Mat &spectrum, float lambda);
+inline void rearrange(cv::Mat &img);
+inline void rearrange(cv::Mat &img, cv::Mat &tmp);
+class FFTBackend;
+inline FFTBackend &getBackend();
+inline void setBackend(FFTBackend *backend);
+inline bool setBackend(const std::string &name);
+inline void normalizedLogTransform(cv::Mat &img);
+
+
+inline cv::Mat fftd(cv::Mat img, bool backwards)
+{
+    if (img.channels() == 1)
+    {
+        cv::Mat planes[] = {cv::Mat_<float> (img), cv::Mat_<float>::zeros(img.size())};
+        //cv::Mat planes[] = {cv::Mat_<double> (img), cv::Mat_<double>::zeros(img.size())};
+        cv::merge(planes, 2, img);
+    }
+    cv::dft(img, img, backwards ? (cv::DFT_INVERSE | cv::DFT_SCALE) : 0 );
 
+    return img;
+}
 
-cv::Mat fftd(cv::Mat img, bool backwards)
+inline cv::Mat real(cv::Mat img)
 {
-/*
-#ifdef USE_FFTW
+    std::vector<cv::Mat> planes;
+    cv::split(img, planes);
+    return planes[0];
+}
 
-    fftw_complex * fm = (fftw_complex*) fftw_malloc(sizeof (fftw_complex) * img.cols * img.rows);
+inline cv::Mat imag(cv::Mat img)
+{
+    std::vector<cv::Mat> planes;
+    cv::split(img, planes);
+    return planes[1];
+}
 
-    fftw_plan p = fftw_plan_dft_2d(img.rows, img.cols, fm, fm, backwards ? 1 : -1, 0 * FFTW_ESTIMATE);
+inline cv::Mat magnitude(cv::Mat img)
+{
+    cv::Mat res;
+    std::vector<cv::Mat> planes;
+    cv::split(img, planes); // planes[0] = Re(DFT(I), planes[1] = Im(DFT(I))
+    if (planes.size() == 1) res = cv::abs(img);
+    else if (planes.size() == 2) cv::magnitude(planes[0], planes[1], res); // planes[0] = magnitude
+    else assert(0);
+    return res;
+}
 
+// Kernels on n interleaved (re, im) float pairs. dst may alias a or b.
+// dst = a * b, or a * conj(b)
+inline void mulComplexInterleaved(const float *a, const float *b, float *dst, int n, bool conjB)
+{
+    int k = 0;
+#if defined(FFTTOOLS_AVX)
+    // lanes hold (re, im) pairs; the sign mask negates the (a_im * b_im) term of the real
+    // part for a * b, or the (a_re * b_im) term of the imaginary part for a * conj(b)
+    const __m256 sign = conjB ? _mm256_setr_ps(0.f, -0.f, 0.f, -0.f, 0.f, -0.f, 0.f, -0.f)
+                              : _mm256_setr_ps(-0.f, 0.f, -0.f, 0.f, -0.f, 0.f, -0.f, 0.f);
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256 va = _mm256_loadu_ps(a + 2 * k);
+        __m256 vb = _mm256_loadu_ps(b + 2 * k);
+        __m256 bre = _mm256_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        __m256 bim = _mm256_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        __m256 aswap = _mm256_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        __m256 cross = _mm256_xor_ps(_mm256_mul_ps(aswap, bim), sign);
+        _mm256_storeu_ps(dst + 2 * k, _mm256_add_ps(_mm256_mul_ps(va, bre), cross));
+    }
+#elif defined(FFTTOOLS_SSE2)
+    const __m128 sign = conjB ? _mm_setr_ps(0.f, -0.f, 0.f, -0.f) : _mm_setr_ps(-0.f, 0.f, -0.f, 0.f);
+    for (; k + 2 <= n; k += 2)
+    {
+        __m128 va = _mm_loadu_ps(a + 2 * k);
+        __m128 vb = _mm_loadu_ps(b + 2 * k);
+        __m128 bre = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128 bim = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        __m128 aswap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 cross = _mm_xor_ps(_mm_mul_ps(aswap, bim), sign);
+        _mm_storeu_ps(dst + 2 * k, _mm_add_ps(_mm_mul_ps(va, bre), cross));
+    }
+#elif defined(FFTTOOLS_NEON)
+    for (; k + 4 <= n; k += 4)
+    {
+        float32x4x2_t va = vld2q_f32(a + 2 * k);
+        float32x4x2_t vb = vld2q_f32(b + 2 * k);
+        float32x4x2_t vr;
+        if (conjB)
+        {
+            vr.val[0] = vmlaq_f32(vmulq_f32(va.val[0], vb.val[0]), va.val[1], vb.val[1]);
+            vr.val[1] = vmlsq_f32(vmulq_f32(va.val[1], vb.val[0]), va.val[0], vb.val[1]);
+        }
+        else
+        {
+            vr.val[0] = vmlsq_f32(vmulq_f32(va.val[0], vb.val[0]), va.val[1], vb.val[1]);
+            vr.val[1] = vmlaq_f32(vmulq_f32(va.val[1], vb.val[0]), va.val[0], vb.val[1]);
+        }
+        vst2q_f32(dst + 2 * k, vr);
+    }
+#endif
+    for (; k < n; k++)
+    {
+        float ar = a[2 * k], ai = a[2 * k + 1];
+        float br = b[2 * k], bi = conjB ? -b[2 * k + 1] : b[2 * k + 1];
+        dst[2 * k] = ar * br - ai * bi;
+        dst[2 * k + 1] = ai * br + ar * bi;
+    }
+}
 
-    if (img.channels() == 1)
+// dst = a / b
+inline void divComplexInterleaved(const float *a, const float *b, float *dst, int n)
+{
+    int k = 0;
+#if defined(FFTTOOLS_AVX)
+    // a / b = a * conj(b) / |b|^2
+    const __m256 sign = _mm256_setr_ps(0.f, -0.f, 0.f, -0.f, 0.f, -0.f, 0.f, -0.f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    for (; k + 4 <= n; k += 4)
     {
-        for (int i = 0; i < img.rows; i++)
-            for (int j = 0; j < img.cols; j++)
-            {
-                fm[i * img.cols + j][0] = img.at<float>(i, j);
-                fm[i * img.cols + j][1] = 0;
-            }
+        __m256 va = _mm256_loadu_ps(a + 2 * k);
+        __m256 vb = _mm256_loadu_ps(b + 2 * k);
+        __m256 bre = _mm256_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        __m256 bim = _mm256_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        __m256 aswap = _mm256_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        __m256 num = _mm256_add_ps(_mm256_mul_ps(va, bre), _mm256_xor_ps(_mm256_mul_ps(aswap, bim), sign));
+        __m256 bsq = _mm256_mul_ps(vb, vb);
+        __m256 den = _mm256_add_ps(bsq, _mm256_shuffle_ps(bsq, bsq, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm256_storeu_ps(dst + 2 * k, _mm256_mul_ps(num, _mm256_div_ps(one, den)));
     }
-    else
+#elif defined(FFTTOOLS_SSE2)
+    const __m128 sign = _mm_setr_ps(0.f, -0.f, 0.f, -0.f);
+    const __m128 one = _mm_set1_ps(1.f);
+    for (; k + 2 <= n; k += 2)
+    {
+        __m128 va = _mm_loadu_ps(a + 2 * k);
+        __m128 vb = _mm_loadu_ps(b + 2 * k);
+        __m128 bre = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128 bim = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        __m128 aswap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 num = _mm_add_ps(_mm_mul_ps(va, bre), _mm_xor_ps(_mm_mul_ps(aswap, bim), sign));
+        __m128 bsq = _mm_mul_ps(vb, vb);
+        __m128 den = _mm_add_ps(bsq, _mm_shuffle_ps(bsq, bsq, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(dst + 2 * k, _mm_mul_ps(num, _mm_div_ps(one, den)));
+    }
+#elif defined(FFTTOOLS_NEON) && defined(__aarch64__)
+    for (; k + 4 <= n; k += 4)
+    {
+        float32x4x2_t va = vld2q_f32(a + 2 * k);
+        float32x4x2_t vb = vld2q_f32(b + 2 * k);
+        float32x4_t divisor = vdivq_f32(vdupq_n_f32(1.f), vmlaq_f32(vmulq_f32(vb.val[0], vb.val[0]), vb.val[1], vb.val[1]));
+        float32x4x2_t vr;
+        vr.val[0] = vmulq_f32(vmlaq_f32(vmulq_f32(va.val[0], vb.val[0]), va.val[1], vb.val[1]), divisor);
+        vr.val[1] = vmulq_f32(vmlsq_f32(vmulq_f32(va.val[1], vb.val[0]), va.val[0], vb.val[1]), divisor);
+        vst2q_f32(dst + 2 * k, vr);
+    }
+#endif
+    for (; k < n; k++)
     {
-        assert(img.channels() == 2);
-        for (int i = 0; i < img.rows; i++)
-            for (int j = 0; j < img.cols; j++)
+        float ar = a[2 * k], ai = a[2 * k + 1];
+        float br = b[2 * k], bi = b[2 * k + 1];
+        float divisor = 1.f / (br * br + bi * bi);
+        dst[2 * k] = (ar * br + ai * bi) * divisor;
+        dst[2 * k + 1] = (ai * br - ar * bi) * divisor;
+    }
+}
+
+// Element-wise product of two CV_32FC2 spectra into dst, without temporaries.
+// dst is only reallocated if it does not match, and may be a or b.
+inline void complexMultiplication(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst, bool conjB)
+{
+    assert(a.type() == CV_32FC2 && b.type() == CV_32FC2 && a.size() == b.size());
+    dst.create(a.size(), CV_32FC2);
+    for (int i = 0; i < a.rows; i++)
+        mulComplexInterleaved(a.ptr<float>(i), b.ptr<float>(i), dst.ptr<float>(i), a.cols, conjB);
+}
+
+inline cv::Mat complexMultiplication(cv::Mat a, cv::Mat b)
+{
+    cv::Mat res;
+    complexMultiplication(a, b, res);
+    return res;
+}
+
+// Element-wise quotient a / b of two CV_32FC2 spectra into dst, without temporaries.
+// dst is only reallocated if it does not match, and may be a or b.
+inline void complexDivision(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
+{
+    assert(a.type() == CV_32FC2 && b.type() == CV_32FC2 && a.size() == b.size());
+    dst.create(a.size(), CV_32FC2);
+    for (int i = 0; i < a.rows; i++)
+        divComplexInterleaved(a.ptr<float>(i), b.ptr<float>(i), dst.ptr<float>(i), a.cols);
+}
+
+inline cv::Mat complexDivision(cv::Mat a, cv::Mat b)
+{
+    cv::Mat res;
+    complexDivision(a, b, res);
+    return res;
+}
+
+// Transforms of one size, created by FFTBackend::createPlan() and kept by the caller. forward()
+// maps a rows x cols CV_32F image to its packed (CCS) spectrum, inverse() maps a packed spectrum
+// back to the scaled real image. A dst of the right size is written in place, and may be the
+// source. A plan owns its buffers: it is not thread-safe, every tracker keeps its own.
+class FFTPlan
+{
+public:
+    FFTPlan(int rows, int cols, int planes) : rows(rows), cols(cols), planes(planes) {}
+    virtual ~FFTPlan() {}
+    virtual void forward(const cv::Mat &img, cv::Mat &dst) = 0;
+    virtual void inverse(const cv::Mat &spectrum, cv::Mat &dst) = 0;
+
+    // Forward transforms of the planes of a feature Mat, one rows x cols plane per row of
+    // features, into dst with their spectra stacked vertically (planes * rows x cols). A
+    // backend can run them as one batch; this one transforms them one by one.
+    virtual void forwardPlanes(const cv::Mat &features, cv::Mat &dst)
+    {
+        assert(features.type() == CV_32F && features.rows == planes && features.cols == rows * cols);
+        dst.create(planes * rows, cols, CV_32F);
+        for (int p = 0; p < planes; p++)
+        {
+            cv::Mat plane(rows, cols, CV_32F, (void *)features.ptr<float>(p));
+            cv::Mat spectrum = dst.rowRange(p * rows, (p + 1) * rows);
+            forward(plane, spectrum);
+        }
+    }
+
+    const int rows, cols, planes;
+};
+
+// Transform backend behind fftdPacked() and the trackers' plans. createPlan() is called
+// concurrently by trackers initialized in parallel and must be thread-safe; the plans it
+// returns are then used without any locking.
+class FFTBackend
+{
+public:
+    virtual ~FFTBackend() {}
+    virtual const char *name() const = 0;
+    // New plan for rows x cols transforms, and forwardPlanes() of PLANES planes, owned by the
+    // caller
+    virtual FFTPlan *createPlan(int rows, int cols, int planes = 1) = 0;
+
+    // One-off transforms through a temporary plan
+    void forward(const cv::Mat &img, cv::Mat &dst)
+    {
+        std::unique_ptr<FFTPlan> plan(createPlan(img.rows, img.cols));
+        plan->forward(img, dst);
+    }
+    void inverse(const cv::Mat &spectrum, cv::Mat &dst)
+    {
+        std::unique_ptr<FFTPlan> plan(createPlan(spectrum.rows, spectrum.cols));
+        plan->inverse(spectrum, dst);
+    }
+};
+
+// Default backend, always available
+class OpenCVFFTBackend : public FFTBackend
+{
+public:
+    const char *name() const { return "opencv"; }
+    FFTPlan *createPlan(int rows, int cols, int planes) { return new Plan(rows, cols, planes); }
+
+private:
+    struct Plan : public FFTPlan
+    {
+        Plan(int rows, int cols, int planes) : FFTPlan(rows, cols, planes) {}
+        void forward(const cv::Mat &img, cv::Mat &dst) { cv::dft(img, dst); }
+        void inverse(const cv::Mat &spectrum, cv::Mat &dst) { cv::dft(spectrum, dst, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT); }
+    };
+};
+
+#ifdef USE_FFTW
+// FFTW backend. The forward and inverse fftwf_plans of a size are created once with
+// FFTW_MEASURE and shared by all the FFTPlans of that size, under the lock since the planner is
+// not thread-safe. Every FFTPlan has its own fftwf_malloc'ed (SIMD aligned) real and
+// half-spectrum buffers and runs the shared plans on them with the new-array execute functions,
+// which are thread-safe, so transforms take no lock. forwardPlanes() runs all the planes as one
+// fftwf_plan_many_dft_r2c batch. FFTW's half spectrum is converted from/to OpenCV's CCS layout
+// on the way, so both backends are interchangeable.
+class FFTWBackend : public FFTBackend
+{
+public:
+    ~FFTWBackend()
+    {
+        for (std::map<Size, Plans>::iterator it = _plans.begin(); it != _plans.end(); ++it)
+        {
+            fftwf_destroy_plan(it->second.forward);
+            fftwf_destroy_plan(it->second.inverse);
+            if (it->second.forward_planes)
+                fftwf_destroy_plan(it->second.forward_planes);
+        }
+    }
+
+    const char *name() const { return "fftw"; }
+
+    FFTPlan *createPlan(int rows, int cols, int planes)
+    {
+        cv::AutoLock lock(_mutex);
+        Plans &plans = _plans[Size(rows, cols, planes)];
+        if (plans.forward == NULL)
+        {
+            // FFTW_MEASURE overwrites the arrays, plan on scratch ones
+            Plan scratch(plans, rows, cols, planes);
+            plans.forward = fftwf_plan_dft_r2c_2d(rows, cols, scratch.real, scratch.half, FFTW_MEASURE);
+            plans.inverse = fftwf_plan_dft_c2r_2d(rows, cols, scratch.half, scratch.real, FFTW_MEASURE);
+            if (planes > 1)
             {
-                fm[i * img.cols + j][0] = img.at<cv::Vec2d > (i, j)[0];
-                fm[i * img.cols + j][1] = img.at<cv::Vec2d > (i, j)[1];
+                int n[2] = {rows, cols};
+                plans.forward_planes = fftwf_plan_many_dft_r2c(2, n, planes, scratch.real, NULL, 1, rows * cols,
+                                                               scratch.half, NULL, 1, rows * (cols / 2 + 1), FFTW_MEASURE);
             }
+        }
+        return new Plan(plans, rows, cols, planes);
     }
-    fftw_execute(p);
-    cv::Mat res(img.rows, img.cols, CV_64FC2);
 
+private:
+    struct Plans
+    {
+        fftwf_plan forward, inverse, forward_planes;
+        Plans() : forward(NULL), inverse(NULL), forward_planes(NULL) {}
+    };
 
-    for (int i = 0; i < img.rows; i++)
-        for (int j = 0; j < img.cols; j++)
+    // (rows, cols, planes) of the plans
+    struct Size
+    {
+        int rows, cols, planes;
+        Size(int r, int c, int p) : rows(r), cols(c), planes(p) {}
+        bool operator<(const Size &b) const
         {
-            res.at<cv::Vec2d > (i, j)[0] = fm[i * img.cols + j][0];
-            res.at<cv::Vec2d > (i, j)[1] = fm[i * img.cols + j][1];
+            return rows != b.rows ? rows < b.rows : cols != b.cols ? cols < b.cols : planes < b.planes;
+        }
+    };
+
+    struct Plan : public FFTPlan
+    {
+        fftwf_plan plan_forward, plan_inverse, plan_forward_planes; // owned by the backend
+        float *real; // planes * rows x cols
+        fftwf_complex *half; // planes * rows x (cols / 2 + 1)
 
-            //  _iout(fm[i * img.cols + j][0]);
+        Plan(const Plans &plans, int rows, int cols, int planes) : FFTPlan(rows, cols, planes),
+            plan_forward(plans.forward), plan_inverse(plans.inverse), plan_forward_planes(plans.forward_planes)
+        {
+            real = (float *)fftwf_malloc(sizeof(float) * planes * rows * cols);
+            half = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * planes * rows * (cols / 2 + 1));
         }
 
-    if (backwards)res *= 1.d / (float) (res.cols * res.rows);
+        ~Plan()
+        {
+            fftwf_free(real);
+            fftwf_free(half);
+        }
 
-    fftw_free(p);
-    fftw_free(fm);
-    return res;
+        void forward(const cv::Mat &img, cv::Mat &dst)
+        {
+            assert(img.type() == CV_32F && img.rows == rows && img.cols == cols);
+            for (int i = 0; i < rows; i++)
+                memcpy(real + i * cols, img.ptr<float>(i), cols * sizeof(float));
+            fftwf_execute_dft_r2c(plan_forward, real, half);
+            dst.create(rows, cols, CV_32F);
+            pack(half, dst);
+        }
 
-#else
-*/
-    if (img.channels() == 1)
+        void inverse(const cv::Mat &spectrum, cv::Mat &dst)
+        {
+            assert(spectrum.type() == CV_32F && spectrum.rows == rows && spectrum.cols == cols);
+            unpack(spectrum, half);
+            fftwf_execute_dft_c2r(plan_inverse, half, real);
+            dst.create(rows, cols, CV_32F);
+            float scale = 1.f / (rows * cols);
+            for (int i = 0; i < rows; i++)
+            {
+                float *pdst = dst.ptr<float>(i);
+                const float *psrc = real + i * cols;
+                for (int j = 0; j < cols; j++)
+                    pdst[j] = psrc[j] * scale;
+            }
+        }
+
+        void forwardPlanes(const cv::Mat &features, cv::Mat &dst)
+        {
+            if (plan_forward_planes == NULL)
+            {
+                FFTPlan::forwardPlanes(features, dst);
+                return;
+            }
+            assert(features.type() == CV_32F && features.rows == planes && features.cols == rows * cols);
+            for (int p = 0; p < planes; p++)
+                memcpy(real + p * rows * cols, features.ptr<float>(p), rows * cols * sizeof(float));
+            fftwf_execute_dft_r2c(plan_forward_planes, real, half);
+            dst.create(planes * rows, cols, CV_32F);
+            for (int p = 0; p < planes; p++)
+            {
+                cv::Mat spectrum = dst.rowRange(p * rows, (p + 1) * rows);
+                pack(half + p * rows * (cols / 2 + 1), spectrum);
+            }
+        }
+    };
+
+    // FFTW half spectrum (rows x (cols/2+1) complex) to CCS, see packedElementwise() for the layout
+    static void pack(const fftwf_complex *half, cv::Mat &dst)
     {
-        cv::Mat planes[] = {cv::Mat_<float> (img), cv::Mat_<float>::zeros(img.size())};
-        //cv::Mat planes[] = {cv::Mat_<double> (img), cv::Mat_<double>::zeros(img.size())};
-        cv::merge(planes, 2, img);
+        int rows = dst.rows, cols = dst.cols, hcols = cols / 2 + 1;
+        bool evenCols = cols > 1 && cols % 2 == 0;
+        for (int c = 0; c < (evenCols ? 2 : 1); c++)
+        {
+            int j = c ? cols - 1 : 0;
+            int v = c ? cols / 2 : 0;
+            dst.at<float>(0, j) = half[v][0];
+            int i = 1, u = 1;
+            for (; i + 1 < rows; i += 2, u++)
+            {
+                dst.at<float>(i, j) = half[u * hcols + v][0];
+                dst.at<float>(i + 1, j) = half[u * hcols + v][1];
+            }
+            if (i < rows)
+                dst.at<float>(i, j) = half[u * hcols + v][0];
+        }
+        int npairs = (cols - (evenCols ? 2 : 1)) / 2;
+        for (int i = 0; i < rows; i++)
+        {
+            float *pdst = dst.ptr<float>(i) + 1;
+            const fftwf_complex *phalf = half + i * hcols + 1;
+            for (int k = 0; k < npairs; k++)
+            {
+                pdst[2 * k] = phalf[k][0];
+                pdst[2 * k + 1] = phalf[k][1];
+            }
+        }
     }
-    cv::dft(img, img, backwards ? (cv::DFT_INVERSE | cv::DFT_SCALE) : 0 );
 
-    return img;
+    // CCS to FFTW half spectrum. The packed columns only store rows 0..rows/2, the other rows
+    // follow from the conjugate symmetry of real transforms.
+    static void unpack(const cv::Mat &src, fftwf_complex *half)
+    {
+        int rows = src.rows, cols = src.cols, hcols = cols / 2 + 1;
+        bool evenCols = cols > 1 && cols % 2 == 0;
+        for (int c = 0; c < (evenCols ? 2 : 1); c++)
+        {
+            int j = c ? cols - 1 : 0;
+            int v = c ? cols / 2 : 0;
+            half[v][0] = src.at<float>(0, j);
+            half[v][1] = 0;
+            int i = 1, u = 1;
+            for (; i + 1 < rows; i += 2, u++)
+            {
+                half[u * hcols + v][0] = src.at<float>(i, j);
+                half[u * hcols + v][1] = src.at<float>(i + 1, j);
+                half[(rows - u) * hcols + v][0] = src.at<float>(i, j);
+                half[(rows - u) * hcols + v][1] = -src.at<float>(i + 1, j);
+            }
+            if (i < rows)
+            {
+                half[u * hcols + v][0] = src.at<float>(i, j);
+                half[u * hcols + v][1] = 0;
+            }
+        }
+        int npairs = (cols - (evenCols ? 2 : 1)) / 2;
+        for (int i = 0; i < rows; i++)
+        {
+            const float *psrc = src.ptr<float>(i) + 1;
+            fftwf_complex *phalf = half + i * hcols + 1;
+            for (int k = 0; k < npairs; k++)
+            {
+                phalf[k][0] = psrc[2 * k];
+                phalf[k][1] = psrc[2 * k + 1];
+            }
+        }
+    }
 
-/*#endif*/
+    std::map<Size, Plans> _plans;
+    cv::Mutex _mutex;
+};
+#endif
 
+inline OpenCVFFTBackend &opencvBackend()
+{
+    static OpenCVFFTBackend backend;
+    return backend;
 }
 
-cv::Mat real(cv::Mat img)
+#ifdef USE_FFTW
+inline FFTWBackend &fftwBackend()
 {
-    std::vector<cv::Mat> planes;
-    cv::split(img, planes);
-    return planes[0];
+    static FFTWBackend backend;
+    return backend;
 }
+#endif
 
-cv::Mat imag(cv::Mat img)
+inline FFTBackend &defaultBackend()
 {
-    std::vector<cv::Mat> planes;
-    cv::split(img, planes);
-    return planes[1];
+#ifdef USE_FFTW
+    return fftwBackend();
+#else
+    return opencvBackend();
+#endif
+}
+
+inline FFTBackend *&currentBackend()
+{
+    static FFTBackend *backend = &defaultBackend();
+    return backend;
+}
+
+// Backend of fftdPacked() and of new plans: FFTW if built with USE_FFTW, cv::dft otherwise
+inline FFTBackend &getBackend()
+{
+    return *currentBackend();
+}
+
+// Replace the backend, e.g. to compare them. Call it before any tracker is initialized, a
+// tracker keeps the plans of the backend it was initialized with; NULL restores the default.
+inline void setBackend(FFTBackend *backend)
+{
+    currentBackend() = backend ? backend : &defaultBackend();
 }
 
-cv::Mat magnitude(cv::Mat img)
+// Same, by name: "opencv", or "fftw" if built with USE_FFTW. Returns false, and keeps the
+// current backend, for any other name.
+inline bool setBackend(const std::string &name)
+{
+    if (name == opencvBackend().name())
+    {
+        setBackend(&opencvBackend());
+        return true;
+    }
+#ifdef USE_FFTW
+    if (name == fftwBackend().name())
+    {
+        setBackend(&fftwBackend());
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Real-to-complex FFT of a single-channel image. The spectrum of a real image is conjugate
+// symmetric, so it is returned as a single-channel CV_32F Mat of the same size in OpenCV's
+// packed CCS layout instead of a full two-plane complex Mat. backwards = true takes a packed
+// spectrum and returns the (scaled) real image.
+inline cv::Mat fftdPacked(cv::Mat img, bool backwards)
 {
     cv::Mat res;
-    std::vector<cv::Mat> planes;
-    cv::split(img, planes); // planes[0] = Re(DFT(I), planes[1] = Im(DFT(I))
-    if (planes.size() == 1) res = cv::abs(img);
-    else if (planes.size() == 2) cv::magnitude(planes[0], planes[1], res); // planes[0] = magnitude
-    else assert(0);
+    fftdPacked(cv::Mat_<float> (img), res, backwards);
     return res;
 }
 
-cv::Mat complexMultiplication(cv::Mat a, cv::Mat b)
+// Same on a CV_32F image, into dst. A dst of the right size is written in place, so it may
+// be a view into a bigger buffer.
+inline void fftdPacked(const cv::Mat &img, cv::Mat &dst, bool backwards)
 {
-    std::vector<cv::Mat> pa;
-    std::vector<cv::Mat> pb;
-    cv::split(a, pa);
-    cv::split(b, pb);
+    assert(img.type() == CV_32F);
+    if (backwards)
+        getBackend().inverse(img, dst);
+    else
+        getBackend().forward(img, dst);
+}
 
-    std::vector<cv::Mat> pres;
-    pres.push_back(pa[0].mul(pb[0]) - pa[1].mul(pb[1]));
-    pres.push_back(pa[0].mul(pb[1]) + pa[1].mul(pb[0]));
+// Applies a complex element-wise operation to two packed (CCS) spectra.
+// CCS layout for a rows x cols spectrum: column 0 (and column cols-1 for even widths) is
+// packed vertically, with a real value in row 0 (and in row rows-1 for even heights) and
+// (re, im) pairs in rows (1,2), (3,4)... All other columns hold interleaved (re, im) pairs
+// in every row, which go through the vectorized kernels one row at a time.
+template <typename Op>
+inline void packedElementwise(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst, const Op &op)
+{
+    assert(a.type() == CV_32F && b.type() == CV_32F && a.size() == b.size());
+    dst.create(a.size(), CV_32F);
+    int rows = a.rows;
+    int cols = a.cols;
+    bool evenCols = cols > 1 && cols % 2 == 0;
 
-    cv::Mat res;
-    cv::merge(pres, res);
+    for (int v = 0; v < (evenCols ? 2 : 1); v++)
+    {
+        int j = v ? cols - 1 : 0;
+        dst.at<float>(0, j) = op.real(a.at<float>(0, j), b.at<float>(0, j));
+        int i = 1;
+        for (; i + 1 < rows; i += 2)
+        {
+            float pa[2] = {a.at<float>(i, j), a.at<float>(i + 1, j)};
+            float pb[2] = {b.at<float>(i, j), b.at<float>(i + 1, j)};
+            float pres[2];
+            op.pairs(pa, pb, pres, 1);
+            dst.at<float>(i, j) = pres[0];
+            dst.at<float>(i + 1, j) = pres[1];
+        }
+        if (i < rows)
+            dst.at<float>(i, j) = op.real(a.at<float>(i, j), b.at<float>(i, j));
+    }
 
-    return res;
+    int npairs = (cols - (evenCols ? 2 : 1)) / 2;
+    for (int i = 0; i < rows; i++)
+        op.pairs(a.ptr<float>(i) + 1, b.ptr<float>(i) + 1, dst.ptr<float>(i) + 1, npairs);
 }
 
-cv::Mat complexDivision(cv::Mat a, cv::Mat b)
+struct PackedMultiplication
+{
+    bool conjB;
+    float real(float a, float b) const { return a * b; }
+    void pairs(const float *a, const float *b, float *dst, int n) const { mulComplexInterleaved(a, b, dst, n, conjB); }
+};
+
+struct PackedDivision
 {
-    std::vector<cv::Mat> pa;
-    std::vector<cv::Mat> pb;
-    cv::split(a, pa);
-    cv::split(b, pb);
+    float real(float a, float b) const { return a / b; }
+    void pairs(const float *a, const float *b, float *dst, int n) const { divComplexInterleaved(a, b, dst, n); }
+};
 
-    cv::Mat divisor = 1. / (pb[0].mul(pb[0]) + pb[1].mul(pb[1]));
+// Element-wise product of two packed spectra, conjugating b if requested.
+// dst is only reallocated if it does not match, and may be a or b.
+inline void complexMultiplicationPacked(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst, bool conjB)
+{
+    PackedMultiplication op;
+    op.conjB = conjB;
+    packedElementwise(a, b, dst, op);
+}
 
-    std::vector<cv::Mat> pres;
+inline cv::Mat complexMultiplicationPacked(cv::Mat a, cv::Mat b, bool conjB)
+{
+    cv::Mat res;
+    complexMultiplicationPacked(a, b, res, conjB);
+    return res;
+}
 
-    pres.push_back((pa[0].mul(pb[0]) + pa[1].mul(pb[1])).mul(divisor));
-    pres.push_back((pa[1].mul(pb[0]) + pa[0].mul(pb[1])).mul(divisor));
+// Element-wise quotient a / b of two packed spectra.
+// dst is only reallocated if it does not match, and may be a or b.
+inline void complexDivisionPacked(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst)
+{
+    packedElementwise(a, b, dst, PackedDivision());
+}
 
+inline cv::Mat complexDivisionPacked(cv::Mat a, cv::Mat b)
+{
     cv::Mat res;
-    cv::merge(pres, res);
+    complexDivisionPacked(a, b, res);
     return res;
 }
 
-void rearrange(cv::Mat &img)
+// b + |a|^2, the imaginary parts of a power spectrum are zero
+struct PackedPowerAccumulation
+{
+    float real(float a, float b) const { return b + a * a; }
+    void pairs(const float *a, const float *b, float *dst, int n) const
+    {
+        for (int k = 0; k < n; k++)
+        {
+            dst[2 * k] = b[2 * k] + a[2 * k] * a[2 * k] + a[2 * k + 1] * a[2 * k + 1];
+            dst[2 * k + 1] = b[2 * k + 1];
+        }
+    }
+};
+
+// Adds the power spectrum |a|^2 of a packed spectrum to dst, in place. This is
+// a * conj(a) without computing the imaginary parts, which are zero.
+inline void accumulatePowerSpectrumPacked(const cv::Mat &a, cv::Mat &dst)
+{
+    assert(dst.type() == CV_32F && dst.size() == a.size());
+    packedElementwise(a, dst, dst, PackedPowerAccumulation());
+}
+
+// re + lambda, or re - lambda for a negative re; the imaginary parts are kept
+struct PackedKernelRegularization
+{
+    float lambda;
+    float real(float a, float) const { return a < 0 ? a - lambda : a + lambda; }
+    void pairs(const float *a, const float *, float *dst, int n) const
+    {
+        for (int k = 0; k < n; k++)
+        {
+            dst[2 * k] = real(a[2 * k], 0);
+            dst[2 * k + 1] = a[2 * k + 1];
+        }
+    }
+};
+
+// Regularizes the spectrum of a kernel autocorrelation, in place, for the division of the
+// ridge regression. The kernel is centered in its window (see rearrange()), so its spectrum is
+// the one of the kernel at the origin, which is non-negative, with the sign flipped at every
+// other frequency. Adding lambda to the magnitude is fft(k) + lambda for the kernel at the
+// origin; adding it to the real part would subtract it at half the frequencies, where a weak
+// frequency could then end at zero.
+inline void regularizeKernelSpectrumPacked(cv::Mat &spectrum, float lambda)
+{
+    PackedKernelRegularization op;
+    op.lambda = lambda;
+    packedElementwise(spectrum, spectrum, spectrum, op);
+}
+
+inline void rearrange(cv::Mat &img)
+{
+    cv::Mat tmp;
+    rearrange(img, tmp);
+}
+
+// Same, with the quadrant buffer given by the caller
+inline void rearrange(cv::Mat &img, cv::Mat &tmp)
 {
     // img = img(cv::Rect(0, 0, img.cols & -2, img.rows & -2));
     int cx = img.cols / 2;
@@ -195,7 +784,7 @@ void rearrange(cv::Mat &img)
     cv::Mat q2(img, cv::Rect(0, cy, cx, cy)); // Bottom-Left
     cv::Mat q3(img, cv::Rect(cx, cy, cx, cy)); // Bottom-Right
 
-    cv::Mat tmp; // swap quadrants (Top-Left with Bottom-Right)
+    // swap quadrants (Top-Left with Bottom-Right)
     q0.copyTo(tmp);
     q3.copyTo(q0);
     tmp.copyTo(q3);
@@ -205,7 +794,7 @@ void rearrange(cv::Mat &img)
 }
 /*
 template < typename type>
-cv::Mat fouriertransFull(const cv::Mat & in)
+inline cv::Mat fouriertransFull(const cv::Mat & in)
 {
     return fftd(in);
 
@@ -226,7 +815,7 @@ cv::Mat fouriertransFull(const cv::Mat & in)
     return t;
 }*/
 
-void normalizedLogTransform(cv::Mat &img)
+inline void normalizedLogTransform(cv::Mat &img)
 {
     img = cv::abs(img);
     img += cv::Scalar::all(1);
@@ -47,6 +47,7 @@
 //#include "_lsvmc_resizeimg.h"
 
 #include "fhog.hpp"
+#include "trace.hpp"
 
 
 #ifdef HAVE_TBB
@@ -55,6 +56,11 @@
 #include "tbb/blocked_range.h"
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FHOG_SSE2
+#endif
+
 #ifndef max
 #define max(a,b)            (((a) > (b)) ? (a) : (b))
 #endif
@@ -79,21 +85,53 @@ int getFeatureSize( int width, int height, const int k, CvLSVMFeatureMapCaskade
 
     return LATENT_SVM_OK;
 }
+
 /*
-// Getting feature map for the selected subimage
+// Cell interpolation weights, shared by both feature map versions
 //
-// API
-// int getFeatureMaps(const IplImage * image, const int k, featureMap **map);
-// INPUT
-// image             - selected subimage
-// k                 - size of cells
-// OUTPUT
-// map               - feature map
-// RESULT
-// Error status
+// nearest[ii] is the neighbour cell (-1 or +1) a pixel at offset ii in its
+// cell also votes for, w[ii * 2] and w[ii * 2 + 1] are the weights of its
+// own cell and of that neighbour
 */
-int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade **map)
+static void cellWeights(const int k, int *nearest, float *w)
+{
+    int i, j;
+    float a_x, b_x;
+
+    for(i = 0; i < k / 2; i++)
+    {
+        nearest[i] = -1;
+    }/*for(i = 0; i < k / 2; i++)*/
+    for(i = k / 2; i < k; i++)
+    {
+        nearest[i] = 1;
+    }/*for(i = k / 2; i < k; i++)*/
+
+    for(j = 0; j < k / 2; j++)
+    {
+        b_x = k / 2 + j + 0.5f;
+        a_x = k / 2 - j - 0.5f;
+        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
+        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
+    }/*for(j = 0; j < k / 2; j++)*/
+    for(j = k / 2; j < k; j++)
+    {
+        a_x = j - k / 2 + 0.5f;
+        b_x =-j + k / 2 - 0.5f + k;
+        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
+        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
+    }/*for(j = k / 2; j < k; j++)*/
+}
+
+/*
+// Feature map of the reference version into a zeroed map, with caller
+// provided gradient images and buffers
+*/
+static void computeFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *map,
+                               IplImage *dx, IplImage *dy, float *r, int *alfa,
+                               const int *nearest, const float *w)
 {
+    KCF_TRACE_SCOPE("fhog::featureMaps");
     int sizeX, sizeY;
     int p, px, stringSize;
     int height, width, numChannels;
@@ -102,17 +140,10 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
     
     int   ch; 
     float magnitude, x, y, tx, ty;
-    
-    IplImage * dx, * dy;
-    int *nearest;
-    float *w, a_x, b_x;
 
     float kernel[3] = {-1.f, 0.f, 1.f};
     CvMat kernel_dx = cvMat(1, 3, CV_32F, kernel);
     CvMat kernel_dy = cvMat(3, 1, CV_32F, kernel);
-
-    float * r;
-    int   * alfa;
     
     float boundary_x[NUM_SECTOR + 1];
     float boundary_y[NUM_SECTOR + 1];
@@ -124,17 +155,11 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
 
     numChannels = image->nChannels;
 
-    dx    = cvCreateImage(cvSize(image->width, image->height), 
-                          IPL_DEPTH_32F, numChannels);
-    dy    = cvCreateImage(cvSize(image->width, image->height), 
-                          IPL_DEPTH_32F, numChannels);
-
     sizeX = width  / k;
     sizeY = height / k;
     px    = 3 * NUM_SECTOR; 
     p     = px;
     stringSize = sizeX * p;
-    allocFeatureMapObject(map, sizeX, sizeY, p);
 
     cvFilter2D(image, dx, &kernel_dx, cvPoint(-1, 0));
     cvFilter2D(image, dy, &kernel_dy, cvPoint(0, -1));
@@ -147,9 +172,6 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
         boundary_y[i] = sinf(arg_vector);
     }/*for(i = 0; i <= NUM_SECTOR; i++) */
 
-    r    = (float *)malloc( sizeof(float) * (width * height));
-    alfa = (int   *)malloc( sizeof(int  ) * (width * height * 2));
-
     for(j = 1; j < height - 1; j++)
     {
         datadx = (float*)(dx->imageData + dx->widthStep * j);
@@ -199,33 +221,6 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
         }/*for(i = 0; i < width; i++)*/
     }/*for(j = 0; j < height; j++)*/
 
-    nearest = (int  *)malloc(sizeof(int  ) *  k);
-    w       = (float*)malloc(sizeof(float) * (k * 2));
-    
-    for(i = 0; i < k / 2; i++)
-    {
-        nearest[i] = -1;
-    }/*for(i = 0; i < k / 2; i++)*/
-    for(i = k / 2; i < k; i++)
-    {
-        nearest[i] = 1;
-    }/*for(i = k / 2; i < k; i++)*/
-
-    for(j = 0; j < k / 2; j++)
-    {
-        b_x = k / 2 + j + 0.5f;
-        a_x = k / 2 - j - 0.5f;
-        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
-        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
-    }/*for(j = 0; j < k / 2; j++)*/
-    for(j = k / 2; j < k; j++)
-    {
-        a_x = j - k / 2 + 0.5f;
-        b_x =-j + k / 2 - 0.5f + k;
-        w[j * 2    ] = 1.0f/a_x * ((a_x * b_x) / ( a_x + b_x)); 
-        w[j * 2 + 1] = 1.0f/b_x * ((a_x * b_x) / ( a_x + b_x));  
-    }/*for(j = k / 2; j < k; j++)*/
-
     for(i = 0; i < sizeY; i++)
     {
       for(j = 0; j < sizeX; j++)
@@ -240,24 +235,24 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
                 (j * k + jj < width  - 1))
             {
               d = (k * i + ii) * width + (j * k + jj);
-              (*map)->map[ i * stringSize + j * (*map)->numFeatures + alfa[d * 2    ]] += 
+              map->map[ i * stringSize + j * map->numFeatures + alfa[d * 2    ]] += 
                   r[d] * w[ii * 2] * w[jj * 2];
-              (*map)->map[ i * stringSize + j * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+              map->map[ i * stringSize + j * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2] * w[jj * 2];
               if ((i + nearest[ii] >= 0) && 
                   (i + nearest[ii] <= sizeY - 1))
               {
-                (*map)->map[(i + nearest[ii]) * stringSize + j * (*map)->numFeatures + alfa[d * 2    ]             ] += 
+                map->map[(i + nearest[ii]) * stringSize + j * map->numFeatures + alfa[d * 2    ]             ] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 ];
-                (*map)->map[(i + nearest[ii]) * stringSize + j * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+                map->map[(i + nearest[ii]) * stringSize + j * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 ];
               }
               if ((j + nearest[jj] >= 0) && 
                   (j + nearest[jj] <= sizeX - 1))
               {
-                (*map)->map[i * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2    ]             ] += 
+                map->map[i * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2    ]             ] += 
                   r[d] * w[ii * 2] * w[jj * 2 + 1];
-                (*map)->map[i * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+                map->map[i * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2] * w[jj * 2 + 1];
               }
               if ((i + nearest[ii] >= 0) && 
@@ -265,9 +260,9 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
                   (j + nearest[jj] >= 0) && 
                   (j + nearest[jj] <= sizeX - 1))
               {
-                (*map)->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2    ]             ] += 
+                map->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2    ]             ] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 + 1];
-                (*map)->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * (*map)->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
+                map->map[(i + nearest[ii]) * stringSize + (j + nearest[jj]) * map->numFeatures + alfa[d * 2 + 1] + NUM_SECTOR] += 
                   r[d] * w[ii * 2 + 1] * w[jj * 2 + 1];
               }
             }
@@ -275,6 +270,49 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
         }/*for(ii = 0; ii < k; ii++)*/
       }/*for(j = 1; j < sizeX - 1; j++)*/
     }/*for(i = 1; i < sizeY - 1; i++)*/
+}
+/*
+// Getting feature map for the selected subimage
+//
+// API
+// int getFeatureMaps(const IplImage * image, const int k, featureMap **map);
+// INPUT
+// image             - selected subimage
+// k                 - size of cells
+// OUTPUT
+// map               - feature map
+// RESULT
+// Error status
+*/
+int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade **map)
+{
+    int height, width, numChannels;
+    IplImage * dx, * dy;
+    int *nearest;
+    float *w;
+    float * r;
+    int   * alfa;
+
+    height = image->height;
+    width  = image->width ;
+
+    numChannels = image->nChannels;
+
+    dx    = cvCreateImage(cvSize(image->width, image->height), 
+                          IPL_DEPTH_32F, numChannels);
+    dy    = cvCreateImage(cvSize(image->width, image->height), 
+                          IPL_DEPTH_32F, numChannels);
+
+    allocFeatureMapObject(map, width / k, height / k, 3 * NUM_SECTOR);
+
+    r    = (float *)malloc( sizeof(float) * (width * height));
+    alfa = (int   *)malloc( sizeof(int  ) * (width * height * 2));
+
+    nearest = (int  *)malloc(sizeof(int  ) *  k);
+    w       = (float*)malloc(sizeof(float) * (k * 2));
+    cellWeights(k, nearest, w);
+
+    computeFeatureMaps(image, k, *map, dx, dy, r, alfa, nearest, w);
     
     cvReleaseImage(&dx);
     cvReleaseImage(&dy);
@@ -290,49 +328,311 @@ int getFeatureMaps(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *
 }
 
 /*
-// Feature map Normalization and Truncation 
+// Orientation bins of all 8-bit gradients
+//
+// The gradients of an 8-bit image are integers in [-255, 255], so the
+// sector search of getFeatureMaps is evaluated once for every (dx, dy)
+// when the library is loaded. The entry is the contrast sensitive bin
+// (0 .. 2 * NUM_SECTOR - 1), the insensitive bin is entry % NUM_SECTOR.
+*/
+#define GRAD_RANGE 255
+#define GRAD_SPAN (2 * GRAD_RANGE + 1)
+
+static struct OrientationTable
+{
+    unsigned char bin[GRAD_SPAN * GRAD_SPAN];
+
+    OrientationTable()
+    {
+        float boundary_x[NUM_SECTOR + 1];
+        float boundary_y[NUM_SECTOR + 1];
+        float arg_vector, x, y, max, dotProd;
+        int i, kk, maxi, dx, dy;
+
+        for(i = 0; i <= NUM_SECTOR; i++)
+        {
+            arg_vector    = ( (float) i ) * ( (float)(PI) / (float)(NUM_SECTOR) );
+            boundary_x[i] = cosf(arg_vector);
+            boundary_y[i] = sinf(arg_vector);
+        }
+        for(dy = -GRAD_RANGE; dy <= GRAD_RANGE; dy++)
+        {
+            for(dx = -GRAD_RANGE; dx <= GRAD_RANGE; dx++)
+            {
+                x = (float)dx;
+                y = (float)dy;
+                max  = boundary_x[0] * x + boundary_y[0] * y;
+                maxi = 0;
+                for (kk = 0; kk < NUM_SECTOR; kk++) 
+                {
+                    dotProd = boundary_x[kk] * x + boundary_y[kk] * y;
+                    if (dotProd > max) 
+                    {
+                        max  = dotProd;
+                        maxi = kk;
+                    }
+                    else 
+                    {
+                        if (-dotProd > max) 
+                        {
+                            max  = -dotProd;
+                            maxi = kk + NUM_SECTOR;
+                        }
+                    }
+                }
+                bin[(dy + GRAD_RANGE) * GRAD_SPAN + dx + GRAD_RANGE] = (unsigned char)maxi;
+            }
+        }
+    }
+} orientationTable;
+
+/*
+// Gradient magnitude and orientation bin of one row of an 8-bit image,
+// for pixels 1 .. width - 2 (border pixels are left untouched)
+//
+// For several channels the channel with the largest magnitude wins, the
+// first one on ties, like in getFeatureMaps.
+*/
+static void gradientRow(const unsigned char *up, const unsigned char *row, const unsigned char *down,
+                        int width, int numChannels, float *r, unsigned char *bin)
+{
+    int i = 1, ch, dx, dy, sq, best, bestdx, bestdy;
+    const unsigned char *table = orientationTable.bin;
+
+    if (numChannels == 1)
+    {
+#ifdef FHOG_SSE2
+        short gx[8], gy[8];
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= width - 1; i += 8)
+        {
+            __m128i left  = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + i - 1)), zero);
+            __m128i right = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + i + 1)), zero);
+            __m128i top   = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(up + i)), zero);
+            __m128i bot   = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(down + i)), zero);
+            __m128i vdx = _mm_sub_epi16(right, left);
+            __m128i vdy = _mm_sub_epi16(bot, top);
+            // dx * dx + dy * dy of 4 pixels at a time
+            __m128i lo = _mm_unpacklo_epi16(vdx, vdy);
+            __m128i hi = _mm_unpackhi_epi16(vdx, vdy);
+            _mm_storeu_ps(r + i,     _mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo))));
+            _mm_storeu_ps(r + i + 4, _mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi))));
+            _mm_storeu_si128((__m128i *)gx, vdx);
+            _mm_storeu_si128((__m128i *)gy, vdy);
+            for (ch = 0; ch < 8; ch++)
+            {
+                bin[i + ch] = table[(gy[ch] + GRAD_RANGE) * GRAD_SPAN + gx[ch] + GRAD_RANGE];
+            }
+        }
+#endif
+        for (; i < width - 1; i++)
+        {
+            dx = row[i + 1] - row[i - 1];
+            dy = down[i] - up[i];
+            r[i]   = sqrtf((float)(dx * dx + dy * dy));
+            bin[i] = table[(dy + GRAD_RANGE) * GRAD_SPAN + dx + GRAD_RANGE];
+        }
+        return;
+    }
+
+    for (; i < width - 1; i++)
+    {
+        best = -1;
+        bestdx = bestdy = 0;
+        for (ch = 0; ch < numChannels; ch++)
+        {
+            dx = row[(i + 1) * numChannels + ch] - row[(i - 1) * numChannels + ch];
+            dy = down[i * numChannels + ch] - up[i * numChannels + ch];
+            sq = dx * dx + dy * dy;
+            if (sq > best)
+            {
+                best   = sq;
+                bestdx = dx;
+                bestdy = dy;
+            }
+        }
+        r[i]   = sqrtf((float)best);
+        bin[i] = table[(bestdy + GRAD_RANGE) * GRAD_SPAN + bestdx + GRAD_RANGE];
+    }
+}
+
+/*
+// Feature map of the fast version into map, with caller provided buffers.
+// r and bin must be zero on the image border, pmap is cleared here.
+*/
+static void computeFeatureMapsFast(const IplImage* image, const int k, CvLSVMFeatureMapCaskade *map,
+                                   float *r, unsigned char *bin,
+                                   const int *nearest, const float *w, float *pmap)
+{
+    KCF_TRACE_SCOPE("fhog::featureMapsFast");
+    int sizeX, sizeY, psizeX;
+    int p, height, width, numChannels;
+    int i, j, ii, jj, d, a0, a1;
+    float rd, wy0, wy1;
+    float *cell, *cellY, *cellX, *cellXY;
+
+    height = image->height;
+    width  = image->width ;
+    numChannels = image->nChannels;
+
+    sizeX = width  / k;
+    sizeY = height / k;
+    p     = 3 * NUM_SECTOR; 
+
+    for(j = 1; j < height - 1; j++)
+    {
+        gradientRow((const unsigned char *)(image->imageData + image->widthStep * (j - 1)),
+                    (const unsigned char *)(image->imageData + image->widthStep *  j     ),
+                    (const unsigned char *)(image->imageData + image->widthStep * (j + 1)),
+                    width, numChannels, r + j * width, bin + j * width);
+    }
+
+    // Cells are accumulated into a map with one cell of padding on every
+    // side, so the neighbour cells outside the map need no test either.
+    // The order of the additions is the one of getFeatureMaps.
+    psizeX = sizeX + 2;
+    memset(pmap, 0, sizeof(float) * psizeX * (sizeY + 2) * p);
+
+    for(i = 0; i < sizeY; i++)
+    {
+      for(j = 0; j < sizeX; j++)
+      {
+        for(ii = 0; ii < k; ii++)
+        {
+          wy0    = w[ii * 2    ];
+          wy1    = w[ii * 2 + 1];
+          cell   = pmap + ((i + 1              ) * psizeX + j + 1) * p;
+          cellY  = pmap + ((i + 1 + nearest[ii]) * psizeX + j + 1) * p;
+          for(jj = 0; jj < k; jj++)
+          {
+            d      = (k * i + ii) * width + (j * k + jj);
+            rd     = r[d];
+            a1     = bin[d];
+            a0     = a1 % NUM_SECTOR;
+            a1    += NUM_SECTOR;
+            cellX  = cell  + nearest[jj] * p;
+            cellXY = cellY + nearest[jj] * p;
+            cell  [a0] += rd * wy0 * w[jj * 2    ];
+            cell  [a1] += rd * wy0 * w[jj * 2    ];
+            cellY [a0] += rd * wy1 * w[jj * 2    ];
+            cellY [a1] += rd * wy1 * w[jj * 2    ];
+            cellX [a0] += rd * wy0 * w[jj * 2 + 1];
+            cellX [a1] += rd * wy0 * w[jj * 2 + 1];
+            cellXY[a0] += rd * wy1 * w[jj * 2 + 1];
+            cellXY[a1] += rd * wy1 * w[jj * 2 + 1];
+          }/*for(jj = 0; jj < k; jj++)*/
+        }/*for(ii = 0; ii < k; ii++)*/
+      }/*for(j = 0; j < sizeX; j++)*/
+    }/*for(i = 0; i < sizeY; i++)*/
+
+    for(i = 0; i < sizeY; i++)
+    {
+        memcpy(map->map + i * sizeX * p, pmap + ((i + 1) * psizeX + 1) * p,
+               sizeof(float) * sizeX * p);
+    }
+}
+
+/*
+// Getting feature map for the selected subimage, fast version
 //
 // API
-// int normalizeAndTruncate(featureMap *map, const float alfa);
+// int getFeatureMapsFast(const IplImage * image, const int k, featureMap **map);
 // INPUT
-// map               - feature map
-// alfa              - truncation threshold
+// image             - selected subimage
+// k                 - size of cells
 // OUTPUT
-// map               - truncated and normalized feature map
+// map               - feature map
 // RESULT
 // Error status
 */
-int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
+int getFeatureMapsFast(const IplImage* image, const int k, CvLSVMFeatureMapCaskade **map)
 {
-    int i,j, ii;
-    int sizeX, sizeY, p, pos, pp, xp, pos1, pos2;
-    float * partOfNorm; // norm of C(i, j)
-    float * newData;
-    float   valOfNorm;
+    int sizeX, sizeY;
+    int height, width;
+    int *nearest;
+    float *w;
+    float *r, *pmap;
+    unsigned char *bin;
 
-    sizeX     = map->sizeX;
-    sizeY     = map->sizeY;
-    partOfNorm = (float *)malloc (sizeof(float) * (sizeX * sizeY));
+    if (image->depth != IPL_DEPTH_8U)
+    {
+        return getFeatureMaps(image, k, map);
+    }
 
-    p  = NUM_SECTOR;
-    xp = NUM_SECTOR * 3;
-    pp = NUM_SECTOR * 12;
+    height = image->height;
+    width  = image->width ;
 
-    for(i = 0; i < sizeX * sizeY; i++)
+    sizeX = width  / k;
+    sizeY = height / k;
+    allocFeatureMapObject(map, sizeX, sizeY, 3 * NUM_SECTOR);
+
+    // Border pixels keep r = 0, so they add nothing and need no test
+    r   = (float *)calloc(width * height, sizeof(float));
+    bin = (unsigned char *)calloc(width * height, sizeof(unsigned char));
+
+    nearest = (int  *)malloc(sizeof(int  ) *  k);
+    w       = (float*)malloc(sizeof(float) * (k * 2));
+    cellWeights(k, nearest, w);
+
+    pmap = (float *)malloc(sizeof(float) * (sizeX + 2) * (sizeY + 2) * 3 * NUM_SECTOR);
+
+    computeFeatureMapsFast(image, k, *map, r, bin, nearest, w, pmap);
+
+    free(pmap);
+    free(w);
+    free(nearest);
+    free(r);
+    free(bin);
+
+    return LATENT_SVM_OK;
+}
+
+/*
+// Squared norm of the contrast insensitive part of every cell of map
+*/
+static void cellNorms(const CvLSVMFeatureMapCaskade *map, float *partOfNorm)
+{
+    int i, j, pos;
+    float valOfNorm;
+
+    for(i = 0; i < map->sizeX * map->sizeY; i++)
     {
         valOfNorm = 0.0f;
         pos = i * map->numFeatures;
-        for(j = 0; j < p; j++)
+        for(j = 0; j < NUM_SECTOR; j++)
         {
             valOfNorm += map->map[pos + j] * map->map[pos + j];
         }/*for(j = 0; j < p; j++)*/
         partOfNorm[i] = valOfNorm;
     }/*for(i = 0; i < sizeX * sizeY; i++)*/
+}
+
+/*
+// Normalization and truncation of map into newData, the map is not changed
+//
+// partOfNorm holds map->sizeX * map->sizeY floats, newData
+// (map->sizeX - 2) * (map->sizeY - 2) * NUM_SECTOR * 12 floats
+*/
+static void normalizeAndTruncateData(const CvLSVMFeatureMapCaskade *map, const float alfa,
+                                     float *partOfNorm, float *newData)
+{
+    KCF_TRACE_SCOPE("fhog::normalizeAndTruncate");
+    int i,j, ii;
+    int sizeX, sizeY, p, pp, xp, pos1, pos2;
+    float   valOfNorm;
+
+    sizeX     = map->sizeX;
+    sizeY     = map->sizeY;
+
+    p  = NUM_SECTOR;
+    xp = NUM_SECTOR * 3;
+    pp = NUM_SECTOR * 12;
+
+    cellNorms(map, partOfNorm);
     
     sizeX -= 2;
     sizeY -= 2;
 
-    newData = (float *)malloc (sizeof(float) * (sizeX * sizeY * pp));
 //normalization
     for(i = 1; i <= sizeY; i++)
     {
@@ -399,6 +699,38 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
     {
         if(newData [i] > alfa) newData [i] = alfa;
     }/*for(i = 0; i < sizeX * sizeY * pp; i++)*/
+}
+
+/*
+// Feature map Normalization and Truncation 
+//
+// API
+// int normalizeAndTruncate(featureMap *map, const float alfa);
+// INPUT
+// map               - feature map
+// alfa              - truncation threshold
+// OUTPUT
+// map               - truncated and normalized feature map
+// RESULT
+// Error status
+*/
+int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
+{
+    int sizeX, sizeY, pp;
+    float * partOfNorm; // norm of C(i, j)
+    float * newData;
+
+    sizeX     = map->sizeX;
+    sizeY     = map->sizeY;
+    partOfNorm = (float *)malloc (sizeof(float) * (sizeX * sizeY));
+
+    pp = NUM_SECTOR * 12;
+    sizeX -= 2;
+    sizeY -= 2;
+
+    newData = (float *)malloc (sizeof(float) * (sizeX * sizeY * pp));
+    normalizeAndTruncateData(map, alfa, partOfNorm, newData);
+
 //swop data
 
     map->numFeatures  = pp;
@@ -413,24 +745,15 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa)
     return LATENT_SVM_OK;
 }
 /*
-// Feature map reduction
-// In each cell we reduce dimension of the feature vector
-// according to original paper special procedure
+// Projection of the normalized map into newData, the map is not changed
 //
-// API
-// int PCAFeatureMaps(featureMap *map)
-// INPUT
-// map               - feature map
-// OUTPUT
-// map               - feature map
-// RESULT
-// Error status
+// newData holds map->sizeX * map->sizeY * (NUM_SECTOR * 3 + 4) floats
 */
-int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
-{ 
+static void pcaData(const CvLSVMFeatureMapCaskade *map, float *newData)
+{
+    KCF_TRACE_SCOPE("fhog::PCA");
     int i,j, ii, jj, k;
     int sizeX, sizeY, p,  pp, xp, yp, pos1, pos2;
-    float * newData;
     float val;
     float nx, ny;
     
@@ -444,8 +767,6 @@ int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
     nx    = 1.0f / sqrtf((float)(xp * 2));
     ny    = 1.0f / sqrtf((float)(yp    ));
 
-    newData = (float *)malloc (sizeof(float) * (sizeX * sizeY * pp));
-
     for(i = 0; i < sizeY; i++)
     {
         for(j = 0; j < sizeX; j++)
@@ -485,17 +806,372 @@ int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
             } /*for(ii = 0; ii < yp; ii++)*/           
         }/*for(j = 0; j < sizeX; j++)*/
     }/*for(i = 0; i < sizeY; i++)*/
+}
+
+/*
+// Feature map reduction
+// In each cell we reduce dimension of the feature vector
+// according to original paper special procedure
+//
+// API
+// int PCAFeatureMaps(featureMap *map)
+// INPUT
+// map               - feature map
+// OUTPUT
+// map               - feature map
+// RESULT
+// Error status
+*/
+int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map)
+{ 
+    float * newData;
+
+    newData = (float *)malloc (sizeof(float) * (map->sizeX * map->sizeY * (NUM_SECTOR * 3 + 4)));
+    pcaData(map, newData);
 //swop data
 
+    map->numFeatures = NUM_SECTOR * 3 + 4;
+
+    free (map->map);
+
+    map->map = newData;
+
+    return LATENT_SVM_OK;
+}
+
+/*
+// Normalization, truncation and reduction of map into newData in one pass,
+// the map is not changed
+//
+// For every cell the four block norms are computed once and the 31
+// reduced features are summed from the truncated values directly, in the
+// order PCAFeatureMaps sums them, so the result is the one of
+// normalizeAndTruncate followed by PCAFeatureMaps.
+//
+// Feature k of output cell c is written to newData[c * cellStep + k * featureStep]:
+// cellStep = NUM_SECTOR * 3 + 4, featureStep = 1 gives the layout of a
+// feature map, cellStep = 1, featureStep = plane size gives one plane per
+// feature. If window is not NULL, the features of cell c are multiplied
+// by window[c].
+//
+// partOfNorm holds map->sizeX * map->sizeY floats
+*/
+static void normalizeAndPCAData(const CvLSVMFeatureMapCaskade *map, const float alfa,
+                                float *partOfNorm, float *newData,
+                                const int cellStep, const int featureStep, const float *window)
+{
+    KCF_TRACE_SCOPE("fhog::normalizeAndPCA");
+    int i, j, ii, jj, k, c;
+    int sizeX, sizeY, xp, stride;
+    const float *cell, *norm;
+    float *out;
+    float blockNorm[4], sens[4], t, val, nx, ny, wc;
+
+    sizeX  = map->sizeX - 2;
+    sizeY  = map->sizeY - 2;
+    stride = map->sizeX;
+    xp     = NUM_SECTOR * 3;
+
+    nx    = 1.0f / sqrtf((float)(NUM_SECTOR * 2));
+    ny    = 1.0f / sqrtf((float)(4));
+
+    cellNorms(map, partOfNorm);
+
+    for(i = 1; i <= sizeY; i++)
+    {
+        for(j = 1; j <= sizeX; j++)
+        {
+            norm = partOfNorm + i * stride + j;
+            // block norms in the order of the four feature groups of
+            // normalizeAndTruncate
+            blockNorm[0] = sqrtf(norm[0] + norm[ 1] + norm[stride    ] + norm[stride + 1]) + FLT_EPSILON;
+            blockNorm[1] = sqrtf(norm[0] + norm[ 1] + norm[-stride   ] + norm[1 - stride]) + FLT_EPSILON;
+            blockNorm[2] = sqrtf(norm[0] + norm[-1] + norm[stride    ] + norm[stride - 1]) + FLT_EPSILON;
+            blockNorm[3] = sqrtf(norm[0] + norm[-1] + norm[-stride   ] + norm[-1 - stride]) + FLT_EPSILON;
+
+            cell = map->map + (i * stride + j) * xp;
+            c    = (i - 1) * sizeX + (j - 1);
+            out  = newData + c * cellStep;
+            // x * 1.0f is exact, so the window costs nothing in accuracy
+            wc   = window ? window[c] : 1.0f;
+            k = 0;
+            sens[0] = sens[1] = sens[2] = sens[3] = 0.0f;
+            // contrast sensitive orientations, summed over the blocks, and
+            // their per block sums for the four texture features
+            for(jj = 0; jj < NUM_SECTOR * 2; jj++)
+            {
+                val = 0;
+                for(ii = 0; ii < 4; ii++)
+                {
+                    t = cell[NUM_SECTOR + jj] / blockNorm[ii];
+                    if(t > alfa) t = alfa;
+                    val      += t;
+                    sens[ii] += t;
+                }
+                out[featureStep * k++] = val * ny * wc;
+            }
+            // contrast insensitive orientations
+            for(jj = 0; jj < NUM_SECTOR; jj++)
+            {
+                val = 0;
+                for(ii = 0; ii < 4; ii++)
+                {
+                    t = cell[jj] / blockNorm[ii];
+                    if(t > alfa) t = alfa;
+                    val += t;
+                }
+                out[featureStep * k++] = val * ny * wc;
+            }
+            for(ii = 0; ii < 4; ii++)
+            {
+                out[featureStep * k++] = sens[ii] * nx * wc;
+            }
+        }/*for(j = 1; j <= sizeX; j++)*/
+    }/*for(i = 1; i <= sizeY; i++)*/
+}
+
+/*
+// Feature map Normalization, Truncation and reduction in one pass
+// Same result as normalizeAndTruncate followed by PCAFeatureMaps, without
+// the NUM_SECTOR * 12 features per cell intermediate map.
+//
+// API
+// int normalizeAndPCAFeatureMaps(featureMap *map, const float alfa);
+// INPUT
+// map               - feature map
+// alfa              - truncation threshold
+// OUTPUT
+// map               - reduced feature map
+// RESULT
+// Error status
+*/
+int normalizeAndPCAFeatureMaps(CvLSVMFeatureMapCaskade *map, const float alfa)
+{
+    int sizeX, sizeY, pp;
+    float * partOfNorm; // norm of C(i, j)
+    float * newData;
+
+    sizeX = map->sizeX;
+    sizeY = map->sizeY;
+    partOfNorm = (float *)malloc (sizeof(float) * (sizeX * sizeY));
+
+    pp = NUM_SECTOR * 3 + 4;
+    sizeX -= 2;
+    sizeY -= 2;
+
+    newData = (float *)malloc (sizeof(float) * (sizeX * sizeY * pp));
+    normalizeAndPCAData(map, alfa, partOfNorm, newData, pp, 1, NULL);
+
     map->numFeatures = pp;
+    map->sizeX = sizeX;
+    map->sizeY = sizeY;
 
     free (map->map);
+    free (partOfNorm);
 
     map->map = newData;
 
     return LATENT_SVM_OK;
 }
 
+/*
+// Feature pipeline with a reusable workspace
+//
+// All buffers of the three stages are allocated once for a given image
+// size, cell size and number of channels. The stages ping-pong between
+// ws->data[0] and ws->data[1], ws->map always describes the last output.
+*/
+int allocFHogWorkspace(FHogWorkspace **ws, const int width, const int height,
+                       const int k, const int numChannels)
+{
+    int sizeX, sizeY, cells, blocks, pixels;
+    FHogWorkspace *obj;
+
+    sizeX  = width  / k;
+    sizeY  = height / k;
+    cells  = sizeX * sizeY;
+    blocks = (sizeX > 2 && sizeY > 2) ? (sizeX - 2) * (sizeY - 2) : 0;
+    pixels = width * height;
+
+    obj = (FHogWorkspace *)calloc(1, sizeof(FHogWorkspace));
+    obj->width       = width;
+    obj->height      = height;
+    obj->k           = k;
+    obj->numChannels = numChannels;
+    obj->sizeX       = sizeX;
+    obj->sizeY       = sizeY;
+
+    // Border pixels of r and bin are never written, they stay 0
+    obj->r       = (float *)calloc(pixels, sizeof(float));
+    obj->bin     = (unsigned char *)calloc(pixels, sizeof(unsigned char));
+    obj->nearest = (int  *)malloc(sizeof(int  ) *  k);
+    obj->w       = (float*)malloc(sizeof(float) * (k * 2));
+    cellWeights(k, obj->nearest, obj->w);
+
+    obj->pmap       = (float *)malloc(sizeof(float) * (sizeX + 2) * (sizeY + 2) * 3 * NUM_SECTOR);
+    obj->partOfNorm = (float *)malloc(sizeof(float) * cells);
+    obj->dataSize   = max(cells * 3 * NUM_SECTOR, blocks * 12 * NUM_SECTOR);
+    obj->data[0]    = (float *)malloc(sizeof(float) * obj->dataSize);
+    obj->data[1]    = (float *)malloc(sizeof(float) * obj->dataSize);
+
+    obj->map.sizeX       = 0;
+    obj->map.sizeY       = 0;
+    obj->map.numFeatures = 0;
+    obj->map.map         = obj->data[0];
+
+    *ws = obj;
+    return LATENT_SVM_OK;
+}
+
+int freeFHogWorkspace(FHogWorkspace **ws)
+{
+    if(*ws == NULL) return LATENT_SVM_MEM_NULL;
+    if((*ws)->dx != NULL) cvReleaseImage(&(*ws)->dx);
+    if((*ws)->dy != NULL) cvReleaseImage(&(*ws)->dy);
+    free((*ws)->r);
+    free((*ws)->alfa);
+    free((*ws)->bin);
+    free((*ws)->nearest);
+    free((*ws)->w);
+    free((*ws)->pmap);
+    free((*ws)->partOfNorm);
+    free((*ws)->data[0]);
+    free((*ws)->data[1]);
+    free(*ws);
+    (*ws) = NULL;
+    return LATENT_SVM_OK;
+}
+
+static int checkWorkspace(const IplImage* image, const FHogWorkspace *ws)
+{
+    if (image->width != ws->width || image->height != ws->height ||
+        image->nChannels != ws->numChannels)
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+    return LATENT_SVM_OK;
+}
+
+// Output buffer of the next stage: the one the current map is not in
+static float *nextBuffer(FHogWorkspace *ws)
+{
+    return ws->map.map == ws->data[0] ? ws->data[1] : ws->data[0];
+}
+
+int getFeatureMaps(const IplImage* image, FHogWorkspace *ws)
+{
+    if (checkWorkspace(image, ws) != LATENT_SVM_OK)
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+
+    // The reference version needs the float gradient images, they are
+    // only allocated the first time it runs on this workspace
+    if (ws->dx == NULL)
+    {
+        ws->dx   = cvCreateImage(cvSize(ws->width, ws->height), IPL_DEPTH_32F, ws->numChannels);
+        ws->dy   = cvCreateImage(cvSize(ws->width, ws->height), IPL_DEPTH_32F, ws->numChannels);
+        ws->alfa = (int *)malloc(sizeof(int) * (ws->width * ws->height * 2));
+    }
+
+    ws->map.sizeX       = ws->sizeX;
+    ws->map.sizeY       = ws->sizeY;
+    ws->map.numFeatures = 3 * NUM_SECTOR;
+    ws->map.map         = ws->data[0];
+    memset(ws->map.map, 0, sizeof(float) * ws->sizeX * ws->sizeY * 3 * NUM_SECTOR);
+
+    computeFeatureMaps(image, ws->k, &ws->map, ws->dx, ws->dy, ws->r, ws->alfa, ws->nearest, ws->w);
+    return LATENT_SVM_OK;
+}
+
+int getFeatureMapsFast(const IplImage* image, FHogWorkspace *ws)
+{
+    if (image->depth != IPL_DEPTH_8U)
+    {
+        return getFeatureMaps(image, ws);
+    }
+    if (checkWorkspace(image, ws) != LATENT_SVM_OK)
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+
+    ws->map.sizeX       = ws->sizeX;
+    ws->map.sizeY       = ws->sizeY;
+    ws->map.numFeatures = 3 * NUM_SECTOR;
+    ws->map.map         = ws->data[0];
+
+    computeFeatureMapsFast(image, ws->k, &ws->map, ws->r, ws->bin, ws->nearest, ws->w, ws->pmap);
+    return LATENT_SVM_OK;
+}
+
+int normalizeAndTruncate(FHogWorkspace *ws, const float alfa)
+{
+    float *newData;
+
+    if (ws->map.numFeatures != 3 * NUM_SECTOR)
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+
+    newData = nextBuffer(ws);
+    normalizeAndTruncateData(&ws->map, alfa, ws->partOfNorm, newData);
+
+    ws->map.numFeatures = NUM_SECTOR * 12;
+    ws->map.sizeX       = ws->sizeX - 2;
+    ws->map.sizeY       = ws->sizeY - 2;
+    ws->map.map         = newData;
+    return LATENT_SVM_OK;
+}
+
+int PCAFeatureMaps(FHogWorkspace *ws)
+{
+    float *newData;
+
+    if (ws->map.numFeatures != NUM_SECTOR * 12)
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+
+    newData = nextBuffer(ws);
+    pcaData(&ws->map, newData);
+
+    ws->map.numFeatures = NUM_SECTOR * 3 + 4;
+    ws->map.map         = newData;
+    return LATENT_SVM_OK;
+}
+
+int normalizeAndPCAFeatureMaps(FHogWorkspace *ws, const float alfa)
+{
+    float *newData;
+
+    if (ws->map.numFeatures != 3 * NUM_SECTOR)
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+
+    newData = nextBuffer(ws);
+    normalizeAndPCAData(&ws->map, alfa, ws->partOfNorm, newData, NUM_SECTOR * 3 + 4, 1, NULL);
+
+    ws->map.numFeatures = NUM_SECTOR * 3 + 4;
+    ws->map.sizeX       = ws->sizeX - 2;
+    ws->map.sizeY       = ws->sizeY - 2;
+    ws->map.map         = newData;
+    return LATENT_SVM_OK;
+}
+
+
+int normalizeAndPCAFeaturePlanes(FHogWorkspace *ws, const float alfa,
+                                 float *planes, const int planeStep, const float *window)
+{
+    if (ws->map.numFeatures != 3 * NUM_SECTOR ||
+        planeStep < (ws->sizeX - 2) * (ws->sizeY - 2))
+    {
+        return FHOG_WORKSPACE_MISMATCH;
+    }
+
+    normalizeAndPCAData(&ws->map, alfa, ws->partOfNorm, planes, 1, planeStep, window);
+    return LATENT_SVM_OK;
+}
 
 //modified from "lsvmc_routine.cpp"
 
@@ -56,8 +56,16 @@
 //#include "_lsvmc_routine.h"
 
 //#include "opencv2/imgproc.hpp"
+#include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc_c.h"
 
+// IplImage header of a cv::Mat, OpenCV 4 replaced the Mat conversion operator with cvIplImage()
+#if CV_VERSION_MAJOR >= 4
+#define fhogIplImage(mat) cvIplImage(mat)
+#else
+#define fhogIplImage(mat) IplImage(mat)
+#endif
+
 
 //modified from "_lsvmc_types.h"
 
@@ -116,6 +124,7 @@ typedef struct{
 #define FFT_OK 2
 #define FFT_ERROR -10
 #define LSVM_PARSER_FILE_NOT_FOUND -11
+#define FHOG_WORKSPACE_MISMATCH -12
 
 
 int getFeatureSize(int width, int height, const int k, CvLSVMFeatureMapCaskade **map);
@@ -136,6 +145,25 @@ int getFeatureSize(int width, int height, const int k, CvLSVMFeatureMapCaskade *
 */
 int getFeatureMaps(const IplImage * image, const int k, CvLSVMFeatureMapCaskade **map);
 
+/*
+// Getting feature map for the selected subimage, fast version
+// Same result as getFeatureMaps for 8-bit images: gradients are computed
+// directly from the pixels, the orientation bin is read from a table
+// instead of searched, and cells are accumulated without boundary tests.
+// Other image depths fall back to getFeatureMaps.
+//
+// API
+// int getFeatureMapsFast(const IplImage * image, const int k, featureMap **map);
+// INPUT
+// image             - selected subimage
+// k                 - size of cells
+// OUTPUT
+// map               - feature map
+// RESULT
+// Error status
+*/
+int getFeatureMapsFast(const IplImage * image, const int k, CvLSVMFeatureMapCaskade **map);
+
 
 /*
 // Feature map Normalization and Truncation 
@@ -168,6 +196,135 @@ int normalizeAndTruncate(CvLSVMFeatureMapCaskade *map, const float alfa);
 */
 int PCAFeatureMaps(CvLSVMFeatureMapCaskade *map);
 
+/*
+// Feature map Normalization, Truncation and reduction in one pass
+// Same result as normalizeAndTruncate followed by PCAFeatureMaps, without
+// the NUM_SECTOR * 12 features per cell intermediate map.
+//
+// API
+// int normalizeAndPCAFeatureMaps(featureMap *map, const float alfa);
+// INPUT
+// map               - feature map
+// alfa              - truncation threshold
+// OUTPUT
+// map               - reduced feature map
+// RESULT
+// Error status
+*/
+int normalizeAndPCAFeatureMaps(CvLSVMFeatureMapCaskade *map, const float alfa);
+
+
+// DataType: STRUCT FHogWorkspace
+// BUFFERS OF THE FEATURE PIPELINE
+//   Everything getFeatureMaps, normalizeAndTruncate and PCAFeatureMaps
+//   need for images of one size (width x height, numChannels) and one
+//   cell size k, allocated once by allocFHogWorkspace.
+// map             - output of the last stage that ran, its map points
+//                   into data[0] or data[1] and is owned by the workspace
+typedef struct{
+    int width;
+    int height;
+    int k;
+    int numChannels;
+    int sizeX;
+    int sizeY;
+    IplImage *dx;
+    IplImage *dy;
+    float *r;
+    int *alfa;
+    unsigned char *bin;
+    int *nearest;
+    float *w;
+    float *pmap;
+    float *partOfNorm;
+    int dataSize;
+    float *data[2];
+    CvLSVMFeatureMapCaskade map;
+} FHogWorkspace;
+
+/*
+// Workspace allocation
+//
+// API
+// int allocFHogWorkspace(FHogWorkspace **ws, const int width, const int height,
+//                        const int k, const int numChannels);
+// INPUT
+// width, height     - size of the subimages
+// k                 - size of cells
+// numChannels       - number of channels of the subimages
+// OUTPUT
+// ws                - workspace
+// RESULT
+// Error status
+*/
+int allocFHogWorkspace(FHogWorkspace **ws, const int width, const int height,
+                       const int k, const int numChannels);
+
+int freeFHogWorkspace(FHogWorkspace **ws);
+
+// DataType: STRUCT FHogWorkspaceHandle
+// OWNER OF A WORKSPACE
+//   Frees the workspace with the handle, and keeps the image window fhog
+//   runs on and the feature planes it writes next to it. Copies start
+//   without them, the owner allocates them on first use, so two owners
+//   never write to the same buffers.
+struct FHogWorkspaceHandle
+{
+    FHogWorkspace *ws;
+    cv::Mat features; // one feature plane per row, rows padded to 8 floats
+    cv::Mat patch; // image window fhog runs on
+
+    FHogWorkspaceHandle() : ws(NULL) {}
+    FHogWorkspaceHandle(const FHogWorkspaceHandle &) : ws(NULL) {}
+    FHogWorkspaceHandle &operator=(const FHogWorkspaceHandle &) { return *this; }
+    ~FHogWorkspaceHandle() { freeFHogWorkspace(&ws); }
+};
+
+/*
+// Same three stages as above, without any allocation: the result is left
+// in ws->map. The image must have the size and number of channels the
+// workspace was allocated for, otherwise FHOG_WORKSPACE_MISMATCH is
+// returned. The stages must run in order, normalizeAndPCAFeatureMaps
+// replaces the last two.
+//
+// API
+// int getFeatureMaps(const IplImage * image, FHogWorkspace *ws);
+// int getFeatureMapsFast(const IplImage * image, FHogWorkspace *ws);
+// int normalizeAndTruncate(FHogWorkspace *ws, const float alfa);
+// int PCAFeatureMaps(FHogWorkspace *ws);
+// int normalizeAndPCAFeatureMaps(FHogWorkspace *ws, const float alfa);
+*/
+int getFeatureMaps(const IplImage * image, FHogWorkspace *ws);
+int getFeatureMapsFast(const IplImage * image, FHogWorkspace *ws);
+int normalizeAndTruncate(FHogWorkspace *ws, const float alfa);
+int PCAFeatureMaps(FHogWorkspace *ws);
+int normalizeAndPCAFeatureMaps(FHogWorkspace *ws, const float alfa);
+
+/*
+// Last stage of the workspace pipeline with a planar output: instead of
+// ws->map, the reduced features are written to caller owned planes, one
+// plane of (sizeX - 2) * (sizeY - 2) cells per feature, cells in row
+// order. Feature k of cell c goes to planes[k * planeStep + c], so
+// planeStep can be rounded up to keep every plane aligned. If window is
+// not NULL, the features of cell c are multiplied by window[c]. ws->map
+// still describes the first stage afterwards.
+//
+// API
+// int normalizeAndPCAFeaturePlanes(FHogWorkspace *ws, const float alfa,
+//                                  float *planes, const int planeStep, const float *window);
+// INPUT
+// ws                - workspace after getFeatureMaps or getFeatureMapsFast
+// alfa              - truncation threshold
+// planeStep         - distance between two planes, in floats
+// window            - weight of every cell, or NULL
+// OUTPUT
+// planes            - NUM_SECTOR * 3 + 4 feature planes
+// RESULT
+// Error status
+*/
+int normalizeAndPCAFeaturePlanes(FHogWorkspace *ws, const float alfa,
+                                 float *planes, const int planeStep, const float *window);
+
 
 //modified from "lsvmc_routine.h"
 
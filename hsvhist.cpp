@@ -45,7 +45,7 @@ bool calc_histogram(Mat imgs,histogram* histo)
 	//histogram* histo;
 	Mat h, s, v;
 	float* hist;
-	int i, r, c, bin;
+	int r, c, bin;
 	
 	if((!histo)||(imgs.empty()))
 	{
@@ -81,55 +81,6 @@ bool calc_histogram(Mat imgs,histogram* histo)
 }
 
 
-
-#if 0
-
-
-/*
-Calculates a cumulative histogram as defined above for a given array
-of images
-
-@param img an array of images over which to compute a cumulative histogram;
-each must have been converted to HSV colorspace using bgr2hsv()
-@param n the number of images in imgs
-
-@return Returns an un-normalized HSV histogram for \a imgs
-*/
-histogram* calc_histogram1(IplImage* imgs)
-{
-	IplImage* img;
-	histogram* histo;
-	IplImage* h, *s, *v;
-	float* hist;
-	int i, r, c, bin;
-
-	histo = (histogram*)malloc(sizeof(histogram));
-	histo->n = NH*NS + NV;
-	hist = histo->histo;
-	memset(hist, 0, histo->n * sizeof(float));
-
-	/* extract individual HSV planes from image */
-	img = imgs;
-	h = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
-	s = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
-	v = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
-	cvSplit(img, h, s, v, NULL);
-
-	/* increment appropriate histogram bin for each pixel */
-	for (r = 0; r < img->height; r++)
-	for (c = 0; c < img->width; c++)
-	{
-		bin = histo_bin( /*pixval32f( h, r, c )*/((float*)(h->imageData + h->widthStep*r))[c],
-			((float*)(s->imageData + s->widthStep*r))[c],
-			((float*)(v->imageData + v->widthStep*r))[c]);
-		hist[bin] += 1;
-	}
-	cvReleaseImage(&h);
-	cvReleaseImage(&s);
-	cvReleaseImage(&v);
-	return histo;
-}
-#endif
 void normalize_histogram(histogram* histo)
 {
 	float* hist;
@@ -187,6 +138,12 @@ float histo_dist_sq(histogram *h1, histogram* h2)
 		sum += sqrt(hist1[i] * hist2[i]);
 	return sum;
 }
+Mat img2hsv(const ColorCache &cache, Rect roi)
+{
+	cache.ensure(ColorCache::HSV, roi);
+	return RectTools::subwindow(cache.image(ColorCache::HSV), roi, cv::BORDER_REPLICATE);
+}
+
 Mat img2hsv(Mat image, Rect roi)
 {
 	Mat imgroi = RectTools::subwindow(image, roi, cv::BORDER_REPLICATE);
@@ -194,7 +151,7 @@ Mat img2hsv(Mat image, Rect roi)
 	
 	imgroi.copyTo(tmproi);
 	tmproi.convertTo(hsv, CV_32FC3, 1.0 / 255.0);
-	cvtColor(hsv, hsv, CV_BGR2HSV);
+	cvtColor(hsv, hsv, cv::COLOR_BGR2HSV);
 	return hsv;
 	
 }
@@ -1,7 +1,9 @@
 #ifndef _HSVHIST_H
 #define _HSVHIST_H
 
-#include <opencv2/opencv.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "colorcache.hpp"
 using namespace cv;
 
 /* number of bins of HSV in histogram */
@@ -37,4 +39,5 @@ float histo_dist_sq(histogram* h1, histogram* h2);
 //histogram* calc_histogram(Mat imgs);
 bool calc_histogram(Mat imgs, histogram* histo);
 Mat img2hsv(Mat image, Rect roi);
+Mat img2hsv(const ColorCache &cache, Rect roi); // same window, from the HSV tiles of the cache
 #endif
\ No newline at end of file
@@ -0,0 +1,569 @@
+// Tracking benchmark: replays a synthetic sequence (textured squares moving over a noise
+// background) or a recorded video with ground truth boxes, for every combination of the
+// requested feature modes, target counts and template sizes, and writes the results as JSON.
+//
+// Usage: kcf_bench [options]
+//     --modes gray,hog,lab     feature modes (lab is HOG with the Lab histogram check)
+//     --targets 1,4,16         target counts of the synthetic sequence
+//     --template-size 64,104   template sizes, 0 uses the ROI size
+//     --frames N               length of the synthetic sequence (default 300)
+//     --video FILE --gt FILE   recorded sequence instead; the ground truth file has one line per
+//                              frame with x y w h of every target (spaces or commas)
+//     --threads N              cv::setNumThreads
+//     --shared-features        MultiKCFTracker::setSharedFeatures
+//     --scale-filter           MultiKCFTracker::setScaleFilter
+//     --json FILE              output file (default kcf_bench.json), - for stdout
+//     --trace FILE             also write a Chrome trace of all runs (see trace.hpp)
+//     --mat-pool               allocate all Mats from a MatPool (see matpool.hpp)
+//     --color-cache            track on a ColorCache, converting only the tiles read (see colorcache.hpp)
+//     --train-reuse S[,R]      train on the detection features moved to the new position while the
+//                              target moves at most S cells and the scale changes at most R
+//                              (KCFTracker::train_shift_features); compare with a run without it
+//     --update-policy          let every target train, only detect or skip frames (see updatepolicy.hpp)
+//     --motion M[,P]           search around a motion prediction, M is cv (constant velocity) or
+//                              kalman, P a smaller padding for it (see motionmodel.hpp)
+//     --fft NAME               FFT backend of the trackers, opencv or fftw (built with USE_FFTW)
+//
+// For every run: frames per second of MultiKCFTracker::update, p50/p99 latency of a frame and
+// of a single target, the time spent preparing the input frame before update (full-frame
+// conversion, or ColorCache::reset with the tiles converted per frame), the time per target update split over the tracker stages (see
+// KCFStageTimes), how many model updates reused the detection features, and the accuracy
+// against the ground truth.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/videoio/videoio.hpp>
+#include "multikcftracker.hpp"
+#include "trace.hpp"
+#include "matpool.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+const int FRAME_W = 640;
+const int FRAME_H = 480;
+const int TARGET_W = 40;
+
+// Frames and ground truth of a sequence, produced one frame at a time
+class Sequence
+{
+public:
+    virtual ~Sequence() {}
+    virtual bool open(int targets) = 0;
+    // BGR frame and ground truth of the next frame, false at the end
+    virtual bool next(Mat &frame, vector<Rect> &truth) = 0;
+};
+
+// Textured squares on a slow ellipse around their own anchor, over a smooth noise background
+class SyntheticSequence : public Sequence
+{
+public:
+    explicit SyntheticSequence(int frames) : _frames(frames), _t(0) {}
+
+    virtual bool open(int targets)
+    {
+        RNG rng(12345);
+        _background.create(FRAME_H, FRAME_W, CV_8UC3);
+        rng.fill(_background, RNG::UNIFORM, 0, 256);
+        GaussianBlur(_background, _background, Size(7, 7), 2.0);
+        _textures.resize(targets);
+        for (int i = 0; i < targets; i++)
+        {
+            _textures[i].create(TARGET_W, TARGET_W, CV_8UC3);
+            rng.fill(_textures[i], RNG::UNIFORM, 0, 256);
+        }
+        _t = 0;
+        return true;
+    }
+
+    virtual bool next(Mat &frame, vector<Rect> &truth)
+    {
+        if (_t >= _frames)
+            return false;
+        _background.copyTo(frame);
+        truth.resize(_textures.size());
+        for (size_t i = 0; i < _textures.size(); i++)
+        {
+            Point2f c = center((int)i, _t);
+            truth[i] = Rect(cvRound(c.x) - TARGET_W / 2, cvRound(c.y) - TARGET_W / 2, TARGET_W, TARGET_W);
+            Rect visible = truth[i] & Rect(0, 0, frame.cols, frame.rows);
+            _textures[i](visible - truth[i].tl()).copyTo(frame(visible));
+        }
+        _t++;
+        return true;
+    }
+
+private:
+    static Point2f center(int i, int t)
+    {
+        float ax = 80.0f + (i * 137) % (FRAME_W - 160);
+        float ay = 80.0f + (i * 89) % (FRAME_H - 160);
+        float a = 0.05f * t + i;
+        return Point2f(ax + 30.0f * std::cos(a), ay + 20.0f * std::sin(a));
+    }
+
+    int _frames;
+    int _t;
+    Mat _background;
+    vector<Mat> _textures;
+};
+
+// Video file with one line of ground truth boxes per frame
+class RecordedSequence : public Sequence
+{
+public:
+    RecordedSequence(const string &video, const string &gt) : _video(video), _gt(gt) {}
+
+    virtual bool open(int)
+    {
+        _capture.release();
+        _truth.close();
+        _truth.clear();
+        _capture.open(_video);
+        _truth.open(_gt.c_str());
+        return _capture.isOpened() && _truth.is_open();
+    }
+
+    virtual bool next(Mat &frame, vector<Rect> &truth)
+    {
+        string line;
+        if (!std::getline(_truth, line) || !_capture.read(frame) || frame.empty())
+            return false;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        istringstream values(line);
+        truth.clear();
+        Rect r;
+        while (values >> r.x >> r.y >> r.width >> r.height)
+            truth.push_back(r);
+        return !truth.empty();
+    }
+
+private:
+    string _video;
+    string _gt;
+    VideoCapture _capture;
+    ifstream _truth;
+};
+
+struct Config
+{
+    string mode;
+    int targets;
+    int template_size;
+};
+
+struct Options
+{
+    vector<string> modes;
+    vector<int> targets;
+    vector<int> template_sizes;
+    int frames;
+    string video;
+    string gt;
+    int threads;
+    bool shared_features;
+    bool scale_filter;
+    string json;
+    string trace;
+    bool mat_pool;
+    bool color_cache;
+    float train_reuse_shift; // negative: tracker defaults
+    float train_reuse_scale;
+    bool update_policy;
+    string motion;
+    float padding; // negative: tracker default
+    string fft; // empty: build default
+};
+
+vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    istringstream in(list);
+    string item;
+    while (std::getline(in, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+vector<int> splitInts(const string &list)
+{
+    vector<string> items = splitList(list);
+    vector<int> values;
+    for (size_t i = 0; i < items.size(); i++)
+        values.push_back(atoi(items[i].c_str()));
+    return values;
+}
+
+// Nearest-rank percentile, p in [0, 1]
+double percentile(vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p * values.size());
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+double overlap(const Rect &a, const Rect &b)
+{
+    double inter = (a & b).area();
+    double uni = a.area() + b.area() - inter;
+    return uni > 0 ? inter / uni : 0;
+}
+
+void addStages(KCFStageTimes &sum, const KCFStageTimes &t)
+{
+    sum.updates += t.updates;
+    sum.update += t.update;
+    sum.features += t.features;
+    sum.correlation += t.correlation;
+    sum.detect_fft += t.detect_fft;
+    sum.psr += t.psr;
+    sum.match += t.match;
+    sum.histogram += t.histogram;
+    sum.scale += t.scale;
+    sum.trains += t.trains;
+    sum.reused_trains += t.reused_trains;
+}
+
+// Runs one configuration and writes its JSON object
+bool run(Sequence &sequence, const Config &config, const Options &options, ostream &json)
+{
+    bool hog = config.mode != "gray";
+    bool lab = config.mode == "lab";
+    // the Lab histogram check works on colour frames, gray and HOG on gray levels like the demo
+    bool color = lab;
+
+    if (!sequence.open(config.targets))
+        return false;
+    Mat frame, input;
+    vector<Rect> truth;
+    if (!sequence.next(frame, truth))
+        return false;
+
+    MultiKCFTracker trackers(hog, false, true, lab);
+    trackers.setTemplateSize(config.template_size);
+    trackers.setSharedFeatures(options.shared_features);
+    trackers.setScaleFilter(options.scale_filter);
+    UpdatePolicyParams policy;
+    policy.enabled = options.update_policy;
+    trackers.setUpdatePolicy(policy);
+    if (options.motion == "cv")
+        trackers.setMotionModel(MOTION_CONSTANT_VELOCITY, options.padding);
+    else if (options.motion == "kalman")
+        trackers.setMotionModel(MOTION_KALMAN, options.padding);
+    if (color)
+        input = frame;
+    else
+        cvtColor(frame, input, COLOR_BGR2GRAY);
+    vector<int> index; // ground truth box of every target
+    for (size_t i = 0; i < truth.size(); i++)
+    {
+        if (trackers.add(truth[i], input) >= 0)
+            index.push_back((int)i);
+    }
+    if (index.empty())
+        return false;
+    trackers.setCollectTimings(true);
+    if (options.train_reuse_shift >= 0)
+    {
+        for (int i = 0; i < trackers.size(); i++)
+        {
+            KCFTracker &tracker = trackers.tracker(i);
+            tracker.train_shift_features = true;
+            tracker.train_reuse_shift = options.train_reuse_shift;
+            tracker.train_reuse_scale = options.train_reuse_scale;
+        }
+    }
+
+    ColorCache cache;
+    ColorCache::Space space = color ? ColorCache::BGR : ColorCache::GRAY;
+    double input_ms = 0;
+    long tiles = 0;
+
+    vector<double> frame_ms;
+    vector<double> target_ms;
+    vector<double> previous(index.size(), 0.0);
+    double error = 0;
+    int matches = 0, successes = 0, lost = 0;
+    while (sequence.next(frame, truth))
+    {
+        int64 start = getTickCount();
+        if (options.color_cache)
+            cache.reset(frame);
+        else if (color)
+            input = frame;
+        else
+            cvtColor(frame, input, COLOR_BGR2GRAY);
+        input_ms += (getTickCount() - start) * 1000.0 / getTickFrequency();
+
+        start = getTickCount();
+        if (options.color_cache)
+            trackers.update(cache, space);
+        else
+            trackers.update(input);
+        frame_ms.push_back((getTickCount() - start) * 1000.0 / getTickFrequency());
+        if (options.color_cache)
+            tiles += cache.convertedTiles();
+
+        for (int i = 0; i < trackers.size(); i++)
+        {
+            const KCFStageTimes &t = trackers.tracker(i).timings;
+            target_ms.push_back(t.update - previous[i]);
+            previous[i] = t.update;
+
+            const TargetResult &res = trackers.result(i);
+            if (res.status == TARGET_LOST)
+                lost++;
+            if (index[i] >= (int)truth.size())
+                continue;
+            const Rect &gt = truth[index[i]];
+            float dx = res.rect.x + res.rect.width * 0.5f - (gt.x + gt.width * 0.5f);
+            float dy = res.rect.y + res.rect.height * 0.5f - (gt.y + gt.height * 0.5f);
+            error += std::sqrt(dx * dx + dy * dy);
+            matches++;
+            if (overlap(res.rect, gt) >= 0.5)
+                successes++;
+        }
+    }
+
+    KCFStageTimes stages;
+    for (int i = 0; i < trackers.size(); i++)
+        addStages(stages, trackers.tracker(i).timings);
+    double total_ms = 0;
+    for (size_t i = 0; i < frame_ms.size(); i++)
+        total_ms += frame_ms[i];
+    int frames = (int)frame_ms.size();
+    double updates = std::max(stages.updates, 1);
+    double other = stages.update - stages.features - stages.correlation - stages.detect_fft - stages.psr -
+                   stages.match - stages.histogram - stages.scale;
+
+    json << "    {\n";
+    json << "      \"mode\": \"" << config.mode << "\", \"targets\": " << trackers.size()
+         << ", \"template_size\": " << config.template_size << ", \"frames\": " << frames
+         << ", \"threads\": " << getNumThreads() << ",\n";
+    json << "      \"fps\": " << (total_ms > 0 ? 1000.0 * frames / total_ms : 0) << ",\n";
+    json << "      \"frame_ms\": {\"mean\": " << (frames > 0 ? total_ms / frames : 0)
+         << ", \"p50\": " << percentile(frame_ms, 0.5) << ", \"p99\": " << percentile(frame_ms, 0.99) << "},\n";
+    json << "      \"input_ms\": {\"mean\": " << (frames > 0 ? input_ms / frames : 0)
+         << ", \"tiles_per_frame\": " << (frames > 0 ? (double)tiles / frames : 0) << "},\n";
+    json << "      \"target_ms\": {\"mean\": " << stages.update / updates
+         << ", \"p50\": " << percentile(target_ms, 0.5) << ", \"p99\": " << percentile(target_ms, 0.99) << "},\n";
+    json << "      \"stages_ms_per_update\": {\"features\": " << stages.features / updates
+         << ", \"gaussian_correlation\": " << stages.correlation / updates
+         << ", \"detect_fft\": " << stages.detect_fft / updates
+         << ", \"psr\": " << stages.psr / updates
+         << ", \"match_template\": " << stages.match / updates
+         << ", \"histogram\": " << stages.histogram / updates
+         << ", \"scale_filter\": " << stages.scale / updates
+         << ", \"other\": " << other / updates << "},\n";
+    int decisions[UPDATE_DECISIONS] = {0};
+    for (int i = 0; i < trackers.size(); i++)
+    {
+        for (int d = 0; d < UPDATE_DECISIONS; d++)
+            decisions[d] += trackers.tracker(i).policy.decisions()[d];
+    }
+    json << "      \"decisions\": {\"train\": " << decisions[UPDATE_TRAIN] << ", \"detect_only\": " << decisions[UPDATE_DETECT_ONLY]
+         << ", \"skip\": " << decisions[UPDATE_SKIP] << "},\n";
+    json << "      \"training\": {\"trains\": " << stages.trains << ", \"reused\": " << stages.reused_trains
+         << ", \"reused_rate\": " << (stages.trains > 0 ? (double)stages.reused_trains / stages.trains : 0) << "},\n";
+    json << "      \"accuracy\": {\"mean_center_error\": " << (matches > 0 ? error / matches : 0)
+         << ", \"success_rate\": " << (matches > 0 ? (double)successes / matches : 0)
+         << ", \"lost_updates\": " << lost << "}\n";
+    json << "    }";
+    return true;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    options.modes = splitList("gray,hog");
+    options.targets = splitInts("1,4");
+    options.template_sizes = splitInts("104");
+    options.frames = 300;
+    options.threads = -1;
+    options.shared_features = false;
+    options.scale_filter = false;
+    options.json = "kcf_bench.json";
+    options.mat_pool = false;
+    options.color_cache = false;
+    options.train_reuse_shift = -1;
+    options.train_reuse_scale = 0;
+    options.update_policy = false;
+    options.motion = "none";
+    options.padding = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--modes" && has_value)
+            options.modes = splitList(argv[++i]);
+        else if (arg == "--targets" && has_value)
+            options.targets = splitInts(argv[++i]);
+        else if (arg == "--template-size" && has_value)
+            options.template_sizes = splitInts(argv[++i]);
+        else if (arg == "--frames" && has_value)
+            options.frames = atoi(argv[++i]);
+        else if (arg == "--video" && has_value)
+            options.video = argv[++i];
+        else if (arg == "--gt" && has_value)
+            options.gt = argv[++i];
+        else if (arg == "--threads" && has_value)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--json" && has_value)
+            options.json = argv[++i];
+        else if (arg == "--trace" && has_value)
+            options.trace = argv[++i];
+        else if (arg == "--shared-features")
+            options.shared_features = true;
+        else if (arg == "--scale-filter")
+            options.scale_filter = true;
+        else if (arg == "--mat-pool")
+            options.mat_pool = true;
+        else if (arg == "--color-cache")
+            options.color_cache = true;
+        else if (arg == "--motion" && has_value)
+        {
+            vector<string> values = splitList(argv[++i]);
+            options.motion = values.size() > 0 ? values[0] : "none";
+            options.padding = values.size() > 1 ? (float)atof(values[1].c_str()) : -1;
+        }
+        else if (arg == "--fft" && has_value)
+            options.fft = argv[++i];
+        else if (arg == "--update-policy")
+            options.update_policy = true;
+        else if (arg == "--train-reuse" && has_value)
+        {
+            vector<string> values = splitList(argv[++i]);
+            options.train_reuse_shift = values.size() > 0 ? (float)atof(values[0].c_str()) : -1;
+            options.train_reuse_scale = values.size() > 1 ? (float)atof(values[1].c_str()) : 0;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << ", see the top of kcf_bench.cpp" << endl;
+            return 1;
+        }
+    }
+    if (options.motion != "none" && options.motion != "cv" && options.motion != "kalman")
+    {
+        cerr << "unknown motion model " << options.motion << endl;
+        return 1;
+    }
+    if (!options.fft.empty() && !KCFTracker::setFFTBackend(options.fft))
+    {
+        cerr << "FFT backend " << options.fft << " is not available" << endl;
+        return 1;
+    }
+    if (options.video.empty() != options.gt.empty())
+    {
+        cerr << "--video and --gt go together" << endl;
+        return 1;
+    }
+    for (size_t i = 0; i < options.modes.size(); i++)
+    {
+        if (options.modes[i] != "gray" && options.modes[i] != "hog" && options.modes[i] != "lab")
+        {
+            cerr << "unknown mode " << options.modes[i] << endl;
+            return 1;
+        }
+    }
+    if (options.threads >= 0)
+        setNumThreads(options.threads);
+    if (!options.trace.empty())
+        Trace::setEnabled(true);
+    if (options.mat_pool)
+        MatPool::install(&MatPool::instance());
+
+    SyntheticSequence synthetic(options.frames);
+    RecordedSequence recorded(options.video, options.gt);
+    Sequence *sequence = options.video.empty() ? static_cast<Sequence *>(&synthetic) : &recorded;
+    // a recorded sequence has its own number of targets
+    vector<int> targets = options.video.empty() ? options.targets : vector<int>(1, 0);
+
+    // the tracker prints to stdout, the results only go there on request
+    bool to_stdout = options.json == "-";
+    ofstream file;
+    if (!to_stdout)
+    {
+        file.open(options.json.c_str());
+        if (!file.is_open())
+        {
+            cerr << "cannot write " << options.json << endl;
+            return 1;
+        }
+    }
+    ostream &json = to_stdout ? cout : file;
+
+    json << "{\n  \"sequence\": \"" << (options.video.empty() ? "synthetic" : options.video) << "\",\n";
+    json << "  \"shared_features\": " << (options.shared_features ? "true" : "false")
+         << ", \"scale_filter\": " << (options.scale_filter ? "true" : "false")
+         << ", \"mat_pool\": " << (options.mat_pool ? "true" : "false")
+         << ", \"color_cache\": " << (options.color_cache ? "true" : "false")
+         << ", \"motion\": \"" << options.motion << "\", \"padding\": " << options.padding
+         << ", \"update_policy\": " << (options.update_policy ? "true" : "false")
+         << ", \"fft\": \"" << (options.fft.empty() ? "default" : options.fft) << "\""
+         << ", \"train_reuse\": ";
+    if (options.train_reuse_shift >= 0)
+        json << "{\"shift\": " << options.train_reuse_shift << ", \"scale\": " << options.train_reuse_scale << "},\n";
+    else
+        json << "null,\n";
+    json << "  \"runs\": [\n";
+    bool first = true;
+    int failed = 0;
+    for (size_t m = 0; m < options.modes.size(); m++)
+    for (size_t n = 0; n < targets.size(); n++)
+    for (size_t s = 0; s < options.template_sizes.size(); s++)
+    {
+        Config config;
+        config.mode = options.modes[m];
+        config.targets = targets[n];
+        config.template_size = options.template_sizes[s];
+        ostringstream result;
+        if (!run(*sequence, config, options, result))
+        {
+            cerr << "run " << config.mode << ", " << config.targets << " targets, template size "
+                 << config.template_size << " failed" << endl;
+            failed++;
+            continue;
+        }
+        json << (first ? "" : ",\n") << result.str();
+        first = false;
+    }
+    json << "\n  ]";
+    if (options.mat_pool)
+    {
+        MatPool::Stats pool = MatPool::instance().stats();
+        json << ",\n  \"mat_pool_stats\": {\"hits\": " << pool.hits << ", \"misses\": " << pool.misses
+             << ", \"cached_bytes\": " << pool.cached_bytes << "}";
+    }
+    json << "\n}\n";
+    if (!to_stdout)
+        cerr << "results written to " << options.json << endl;
+    if (!options.trace.empty())
+    {
+        if (!Trace::writeChromeTrace(options.trace.c_str()))
+        {
+            cerr << "cannot write " << options.trace << endl;
+            failed++;
+        }
+        else if (Trace::dropped() > 0)
+            cerr << Trace::dropped() << " trace events dropped, the trace is incomplete" << endl;
+    }
+    return failed > 0 ? 1 : 0;
+}
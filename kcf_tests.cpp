@@ -0,0 +1,549 @@
+// Equivalence checks of the optimized code paths against the code they replace or a plain
+// reference implementation: packed spectra against split complex ones, the SIMD spectrum kernels
+// against scalar arithmetic, the FFT backends against cv::dft, the fast and fused fhog stages
+// against the original ones, and the decisions and predictions of UpdatePolicy, MotionModel,
+// MatPool and ColorCache.
+//
+// Usage: kcf_tests [name...]   runs every check, or those whose name contains one of the names
+//
+// Prints one line per check and exits with 1 if any failed. Registered with ctest.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "ffttools.hpp"
+#include "fhog.hpp"
+#include "updatepolicy.hpp"
+#include "motionmodel.hpp"
+#include "matpool.hpp"
+#include "colorcache.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+int failures = 0;
+
+// Counts and reports a failed condition of the running check
+void check(bool ok, const char *expr, int line)
+{
+    if (!ok)
+    {
+        cout << "    failed: " << expr << " (line " << line << ")" << endl;
+        failures++;
+    }
+}
+#define CHECK(expr) check((expr), #expr, __LINE__)
+
+// Largest difference between a and the reference b, relative to the largest value of b
+double relativeError(const Mat &a, const Mat &b)
+{
+    CV_Assert(a.size() == b.size() && a.type() == b.type());
+    return norm(a, b, NORM_INF) / std::max(norm(b, NORM_INF), 1e-20);
+}
+
+Mat randomImage(RNG &rng, int rows, int cols, int type = CV_32F, double low = -1, double high = 1)
+{
+    Mat m(rows, cols, type);
+    rng.fill(m, RNG::UNIFORM, low, high);
+    return m;
+}
+
+// Real part of the inverse transform of a split (two-channel) spectrum
+Mat inverseSplit(const Mat &spectrum)
+{
+    return FFTTools::real(FFTTools::fftd(spectrum.clone(), true));
+}
+
+// Sizes of the spectrum checks: even and odd, square and not
+const Size spectrumSizes[] = {Size(16, 16), Size(17, 15), Size(9, 12), Size(24, 10)};
+const int spectrumSizeCount = sizeof(spectrumSizes) / sizeof(spectrumSizes[0]);
+
+void packedMultiplication()
+{
+    RNG rng(1);
+    for (int s = 0; s < spectrumSizeCount; s++)
+    {
+        Mat a = randomImage(rng, spectrumSizes[s].height, spectrumSizes[s].width);
+        Mat b = randomImage(rng, spectrumSizes[s].height, spectrumSizes[s].width);
+        for (int conj = 0; conj < 2; conj++)
+        {
+            Mat split;
+            FFTTools::complexMultiplication(FFTTools::fftd(a.clone()), FFTTools::fftd(b.clone()), split, conj != 0);
+            Mat packed = FFTTools::complexMultiplicationPacked(FFTTools::fftdPacked(a), FFTTools::fftdPacked(b), conj != 0);
+            CHECK(relativeError(FFTTools::fftdPacked(packed, true), inverseSplit(split)) < 1e-5);
+        }
+        // in place
+        Mat af = FFTTools::fftdPacked(a);
+        Mat product = FFTTools::complexMultiplicationPacked(af, FFTTools::fftdPacked(b));
+        FFTTools::complexMultiplicationPacked(af, FFTTools::fftdPacked(b), af);
+        CHECK(relativeError(af, product) == 0);
+    }
+}
+
+void packedDivision()
+{
+    RNG rng(2);
+    for (int s = 0; s < spectrumSizeCount; s++)
+    {
+        Mat a = randomImage(rng, spectrumSizes[s].height, spectrumSizes[s].width);
+        // a strong impulse keeps every frequency of b far from zero
+        Mat b = randomImage(rng, spectrumSizes[s].height, spectrumSizes[s].width, CV_32F, -0.01, 0.01);
+        b.at<float>(0, 0) += 10;
+        Mat split;
+        FFTTools::complexDivision(FFTTools::fftd(a.clone()), FFTTools::fftd(b.clone()), split);
+        Mat packed = FFTTools::complexDivisionPacked(FFTTools::fftdPacked(a), FFTTools::fftdPacked(b));
+        CHECK(relativeError(FFTTools::fftdPacked(packed, true), inverseSplit(split)) < 1e-5);
+    }
+}
+
+void packedPowerSpectrum()
+{
+    RNG rng(3);
+    for (int s = 0; s < spectrumSizeCount; s++)
+    {
+        Mat af = FFTTools::fftdPacked(randomImage(rng, spectrumSizes[s].height, spectrumSizes[s].width));
+        Mat sum = FFTTools::fftdPacked(randomImage(rng, spectrumSizes[s].height, spectrumSizes[s].width));
+        Mat reference = sum + FFTTools::complexMultiplicationPacked(af, af, true);
+        FFTTools::accumulatePowerSpectrumPacked(af, sum);
+        CHECK(relativeError(sum, reference) < 1e-6);
+    }
+}
+
+// The kernel is centered in its window, which flips the sign of every other frequency of its
+// spectrum and of the one of the centered Gaussian peak. Regularizing its spectrum must give the
+// same ridge regression as the kernel at the origin with lambda added to its spectrum.
+void kernelRegularization()
+{
+    const int rows = 16, cols = 24;
+    const float lambda = 0.1f;
+    Mat k(rows, cols, CV_32F), y(rows, cols, CV_32F);
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            int di = std::min(i, rows - i), dj = std::min(j, cols - j);
+            k.at<float>(i, j) = std::exp(-(di * di + dj * dj) / (2 * 0.7f * 0.7f));
+            y.at<float>(i, j) = std::exp(-(di * di + dj * dj) / (2 * 2.0f * 2.0f));
+        }
+    }
+    Mat k0 = k.clone();
+    k0.at<float>(0, 0) += lambda; // lambda on every frequency of the kernel at the origin
+    Mat reference = FFTTools::complexDivisionPacked(FFTTools::fftdPacked(y), FFTTools::fftdPacked(k0));
+
+    Mat kc = k.clone(), yc = y.clone();
+    FFTTools::rearrange(kc);
+    FFTTools::rearrange(yc);
+    Mat kcf = FFTTools::fftdPacked(kc);
+    FFTTools::regularizeKernelSpectrumPacked(kcf, lambda);
+    Mat alphaf = FFTTools::complexDivisionPacked(FFTTools::fftdPacked(yc), kcf);
+    CHECK(relativeError(alphaf, reference) < 1e-4);
+}
+
+// Scalar reference of mulComplexInterleaved() and divComplexInterleaved(), in double
+void complexReference(const float *a, const float *b, double *mul, double *mulConj, double *div, int n)
+{
+    for (int k = 0; k < n; k++)
+    {
+        double ar = a[2 * k], ai = a[2 * k + 1], br = b[2 * k], bi = b[2 * k + 1];
+        mul[2 * k] = ar * br - ai * bi;
+        mul[2 * k + 1] = ar * bi + ai * br;
+        mulConj[2 * k] = ar * br + ai * bi;
+        mulConj[2 * k + 1] = ai * br - ar * bi;
+        double den = br * br + bi * bi;
+        div[2 * k] = (ar * br + ai * bi) / den;
+        div[2 * k + 1] = (ai * br - ar * bi) / den;
+    }
+}
+
+bool closeTo(const float *values, const double *reference, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (std::fabs(values[i] - reference[i]) > 1e-5 * (std::fabs(reference[i]) + 1))
+            return false;
+    }
+    return true;
+}
+
+// Every length up to a few vectors, so both the vector loops and the scalar tails run
+void simdKernels()
+{
+    RNG rng(4);
+    for (int n = 0; n <= 37; n++)
+    {
+        Mat a = randomImage(rng, 1, 2 * n + 2), b = randomImage(rng, 1, 2 * n + 2);
+        const float *pa = a.ptr<float>(), *pb = b.ptr<float>();
+        vector<double> mul(2 * n + 2), mulConj(2 * n + 2), div(2 * n + 2);
+        complexReference(pa, pb, &mul[0], &mulConj[0], &div[0], n);
+        vector<float> dst(2 * n + 2);
+        FFTTools::mulComplexInterleaved(pa, pb, &dst[0], n, false);
+        CHECK(closeTo(&dst[0], &mul[0], 2 * n));
+        FFTTools::mulComplexInterleaved(pa, pb, &dst[0], n, true);
+        CHECK(closeTo(&dst[0], &mulConj[0], 2 * n));
+        FFTTools::divComplexInterleaved(pa, pb, &dst[0], n);
+        CHECK(closeTo(&dst[0], &div[0], 2 * n));
+    }
+}
+
+void fftBackend(FFTTools::FFTBackend &backend)
+{
+    RNG rng(5);
+    const int planes = 3;
+    for (int s = 0; s < spectrumSizeCount; s++)
+    {
+        int rows = spectrumSizes[s].height, cols = spectrumSizes[s].width;
+        FFTTools::FFTPlan *plan = backend.createPlan(rows, cols, planes);
+        Mat img = randomImage(rng, rows, cols), reference, spectrum, back;
+        dft(img, reference);
+        plan->forward(img, spectrum);
+        CHECK(relativeError(spectrum, reference) < 1e-5);
+        plan->inverse(spectrum, back);
+        CHECK(relativeError(back, img) < 1e-5);
+        backend.forward(img, spectrum);
+        CHECK(relativeError(spectrum, reference) < 1e-5);
+
+        // one plane per row, spectra stacked
+        Mat features = randomImage(rng, planes, rows * cols), spectra;
+        plan->forwardPlanes(features, spectra);
+        CHECK(spectra.rows == planes * rows && spectra.cols == cols);
+        for (int p = 0; p < planes; p++)
+        {
+            Mat plane = features.row(p).reshape(1, rows);
+            dft(plane, reference);
+            CHECK(relativeError(spectra.rowRange(p * rows, (p + 1) * rows), reference) < 1e-5);
+        }
+        delete plan;
+    }
+}
+
+void fftBackends()
+{
+    fftBackend(FFTTools::opencvBackend());
+#ifdef USE_FFTW
+    fftBackend(FFTTools::fftwBackend());
+#endif
+    CHECK(!FFTTools::setBackend("none"));
+    CHECK(FFTTools::setBackend("opencv") && string(FFTTools::getBackend().name()) == "opencv");
+    FFTTools::setBackend(NULL);
+}
+
+// Maps of the same layout and values
+bool sameMap(const CvLSVMFeatureMapCaskade *a, const CvLSVMFeatureMapCaskade *b, float tolerance)
+{
+    if (a->sizeX != b->sizeX || a->sizeY != b->sizeY || a->numFeatures != b->numFeatures)
+        return false;
+    int count = a->sizeX * a->sizeY * a->numFeatures;
+    for (int i = 0; i < count; i++)
+    {
+        if (std::fabs(a->map[i] - b->map[i]) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+// getFeatureMapsFast and the fused normalizeAndPCAFeatureMaps against the original stages, with
+// and without a workspace, on gray and colour windows of the tracker's shape
+void fhog()
+{
+    RNG rng(6);
+    const int k = 4;
+    for (int channels = 1; channels <= 3; channels += 2)
+    {
+        Mat z = randomImage(rng, k * 12, k * 14, CV_8UC(channels), 0, 256);
+        GaussianBlur(z, z, Size(3, 3), 0.8); // gradients in every direction, not only noise
+        IplImage z_ipl = fhogIplImage(z);
+
+        CvLSVMFeatureMapCaskade *reference = NULL, *fast = NULL;
+        getFeatureMaps(&z_ipl, k, &reference);
+        getFeatureMapsFast(&z_ipl, k, &fast);
+        CHECK(sameMap(fast, reference, 1e-4f));
+        normalizeAndTruncate(reference, 0.2f);
+        PCAFeatureMaps(reference);
+        normalizeAndPCAFeatureMaps(fast, 0.2f);
+        CHECK(sameMap(fast, reference, 1e-5f));
+
+        FHogWorkspace *ws = NULL;
+        CHECK(allocFHogWorkspace(&ws, z.cols, z.rows, k, channels) == LATENT_SVM_OK);
+        CHECK(getFeatureMapsFast(&z_ipl, ws) == LATENT_SVM_OK);
+        CHECK(normalizeAndPCAFeatureMaps(ws, 0.2f) == LATENT_SVM_OK);
+        CHECK(sameMap(&ws->map, reference, 1e-5f));
+
+        // planar output: feature f of cell c at planes[f * step + c]
+        CHECK(getFeatureMapsFast(&z_ipl, ws) == LATENT_SVM_OK);
+        int cells = reference->sizeX * reference->sizeY, step = (cells + 7) & ~7;
+        vector<float> planes(reference->numFeatures * step);
+        CHECK(normalizeAndPCAFeaturePlanes(ws, 0.2f, &planes[0], step, NULL) == LATENT_SVM_OK);
+        bool same = true;
+        for (int c = 0; c < cells; c++)
+        {
+            for (int f = 0; f < reference->numFeatures; f++)
+                same = same && std::fabs(planes[f * step + c] - reference->map[c * reference->numFeatures + f]) <= 1e-5f;
+        }
+        CHECK(same);
+
+        freeFHogWorkspace(&ws);
+        freeFeatureMapObject(&reference);
+        freeFeatureMapObject(&fast);
+    }
+}
+
+void updatePolicy()
+{
+    // disabled: every frame trains, nothing is skipped
+    UpdatePolicy off;
+    CHECK(off.decide(0, 0, 100) == UPDATE_TRAIN);
+    CHECK(!off.skipDetection());
+
+    UpdatePolicyParams params;
+    params.enabled = true;
+
+    // stable frames only detect until max_train_interval, skip_after of them arm a skip
+    UpdatePolicy stable;
+    stable.params = params;
+    for (int i = 0; i < params.skip_after; i++)
+        CHECK(stable.decide(5, 10, 0.1f) == UPDATE_DETECT_ONLY);
+    CHECK(stable.skipDetection());
+    CHECK(!stable.skipDetection());
+    CHECK(stable.decide(5, 10, 0.1f) == UPDATE_TRAIN); // max_train_interval frames after the last training
+    CHECK(stable.decisions()[UPDATE_TRAIN] == 1 && stable.decisions()[UPDATE_DETECT_ONLY] == 3 && stable.decisions()[UPDATE_SKIP] == 1);
+
+    // a moving target trains on every reliable frame and is never skipped
+    UpdatePolicy moving;
+    moving.params = params;
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(moving.decide(5, 10, 3) == UPDATE_TRAIN);
+        CHECK(!moving.skipDetection());
+    }
+
+    // unreliable responses do not train, until max_untrained_interval
+    UpdatePolicy weak;
+    weak.params = params;
+    for (int i = 1; i < params.max_untrained_interval; i++)
+        CHECK(weak.decide(1, 10, 3) == UPDATE_DETECT_ONLY);
+    CHECK(weak.decide(1, 10, 3) == UPDATE_TRAIN);
+
+    // APCE compared with its mean over the trained frames
+    UpdatePolicy apce;
+    apce.params = params;
+    CHECK(apce.decide(3, 10, 3) == UPDATE_TRAIN);
+    CHECK(apce.decide(3, 10 * params.min_apce_ratio - 1, 3) == UPDATE_DETECT_ONLY);
+    CHECK(apce.decide(3, 10 * params.min_apce_ratio + 1, 3) == UPDATE_TRAIN);
+}
+
+// Textbook constant velocity Kalman filter of one axis, in double: x = (position, velocity),
+// F = [1 1; 0 1], Q of a white noise acceleration, H = [1 0]
+struct ReferenceKalman
+{
+    double x[2], P[2][2], q, r;
+
+    ReferenceKalman(double position, double process_noise, double measurement_noise)
+    {
+        x[0] = position;
+        x[1] = 0;
+        q = process_noise * process_noise;
+        r = measurement_noise * measurement_noise;
+        P[0][0] = r;
+        P[0][1] = P[1][0] = 0;
+        P[1][1] = 100;
+    }
+
+    void predict()
+    {
+        const double F[2][2] = {{1, 1}, {0, 1}};
+        const double Q[2][2] = {{0.25 * q, 0.5 * q}, {0.5 * q, q}};
+        double FP[2][2], Pn[2][2];
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                FP[i][j] = F[i][0] * P[0][j] + F[i][1] * P[1][j];
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                Pn[i][j] = FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + Q[i][j];
+        memcpy(P, Pn, sizeof(P));
+        x[0] += x[1];
+    }
+
+    void correct(double z)
+    {
+        predict();
+        double s = P[0][0] + r;
+        double K[2] = {P[0][0] / s, P[1][0] / s};
+        double innovation = z - x[0];
+        x[0] += K[0] * innovation;
+        x[1] += K[1] * innovation;
+        double Pn[2][2];
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                Pn[i][j] = P[i][j] - K[i] * P[0][j];
+        memcpy(P, Pn, sizeof(P));
+    }
+};
+
+void motionModel()
+{
+    // a target moving by (3, -2) per frame, with a missed detection at frame 10
+    cv::Point2f start(100, 50), step(3, -2);
+
+    MotionModel none;
+    none.reset(start);
+    none.correct(start + step);
+    CHECK(none.predict() == start + step);
+
+    MotionModel velocity;
+    velocity.type = MOTION_CONSTANT_VELOCITY;
+    velocity.reset(start);
+    for (int f = 1; f < 30; f++)
+        velocity.correct(start + step * (float)f);
+    cv::Point2f predicted = velocity.predict(), expected = start + step * 30.f;
+    CHECK(std::fabs(predicted.x - expected.x) < 1e-3 && std::fabs(predicted.y - expected.y) < 1e-3);
+    velocity.coast();
+    CHECK(velocity.predict() == predicted + velocity.velocity());
+
+    MotionModel kalman;
+    kalman.type = MOTION_KALMAN;
+    kalman.reset(start);
+    ReferenceKalman x(start.x, kalman.process_noise, kalman.measurement_noise);
+    ReferenceKalman y(start.y, kalman.process_noise, kalman.measurement_noise);
+    RNG rng(7);
+    bool same = true;
+    for (int f = 1; f < 30; f++)
+    {
+        cv::Point2f detected = start + step * (float)f + cv::Point2f((float)rng.gaussian(1), (float)rng.gaussian(1));
+        if (f == 10)
+        {
+            kalman.coast();
+            x.predict();
+            y.predict();
+        }
+        else
+        {
+            kalman.correct(detected);
+            x.correct(detected.x);
+            y.correct(detected.y);
+        }
+        cv::Point2f p = kalman.predict();
+        same = same && std::fabs(p.x - (x.x[0] + x.x[1])) < 1e-3 && std::fabs(p.y - (y.x[0] + y.x[1])) < 1e-3;
+    }
+    CHECK(same);
+    CHECK(std::fabs(kalman.velocity().x - step.x) < 0.5 && std::fabs(kalman.velocity().y - step.y) < 0.5);
+}
+
+void matPool()
+{
+    MatPool pool;
+    uchar *first;
+    {
+        Mat m;
+        m.allocator = &pool;
+        m.create(100, 100, CV_32F);
+        first = m.data;
+    }
+    MatPool::Stats stats = pool.stats();
+    CHECK(stats.misses == 1 && stats.hits == 0 && stats.cached_bytes == 100 * 100 * sizeof(float));
+    {
+        // same number of bytes, another type: the buffer comes back
+        Mat m;
+        m.allocator = &pool;
+        m.create(100, 100, CV_8UC4);
+        CHECK(m.data == first);
+        Mat other;
+        other.allocator = &pool;
+        other.create(50, 100, CV_32F);
+        CHECK(other.data != first);
+    }
+    stats = pool.stats();
+    CHECK(stats.misses == 2 && stats.hits == 1 && stats.cached_bytes == 150 * 100 * sizeof(float));
+    pool.trim();
+    CHECK(pool.stats().cached_bytes == 0);
+
+    // buffers beyond max_cached go back to the system
+    MatPool small(1000);
+    {
+        Mat m;
+        m.allocator = &small;
+        m.create(100, 100, CV_32F);
+    }
+    CHECK(small.stats().cached_bytes == 0);
+}
+
+// Tiles of a ColorCache hold what the full-frame conversions give
+void colorCache()
+{
+    RNG rng(8);
+    Mat frame = randomImage(rng, 150, 200, CV_8UC3, 0, 256);
+    Mat gray, hsv;
+    cvtColor(frame, gray, COLOR_BGR2GRAY);
+    frame.convertTo(hsv, CV_32FC3, 1.0 / 255.0);
+    cvtColor(hsv, hsv, COLOR_BGR2HSV);
+
+    ColorCache cache;
+    cache.reset(frame);
+    Rect inside(70, 30, 50, 40); // two tiles
+    cache.ensure(ColorCache::GRAY, inside);
+    CHECK(cache.convertedTiles() == 2);
+    CHECK(norm(cache.image(ColorCache::GRAY)(inside), gray(inside), NORM_INF) == 0);
+    cache.ensure(ColorCache::GRAY, inside);
+    CHECK(cache.convertedTiles() == 2);
+
+    // clipped to the frame
+    Rect border(-20, 120, 80, 60);
+    cache.ensure(ColorCache::GRAY, border);
+    Rect clipped = border & Rect(0, 0, frame.cols, frame.rows);
+    CHECK(norm(cache.image(ColorCache::GRAY)(clipped), gray(clipped), NORM_INF) == 0);
+
+    cache.ensure(ColorCache::HSV, inside);
+    CHECK(norm(cache.image(ColorCache::HSV)(inside), hsv(inside), NORM_INF) < 1e-5);
+
+    // a new frame starts without tiles, a gray frame is its own GRAY image
+    cache.reset(gray);
+    CHECK(cache.convertedTiles() == 0);
+    cache.ensure(ColorCache::GRAY, inside);
+    CHECK(norm(cache.image(ColorCache::GRAY)(inside), gray(inside), NORM_INF) == 0);
+}
+
+struct Check
+{
+    const char *name;
+    void (*run)();
+};
+
+const Check checks[] = {
+    {"packed_multiplication", packedMultiplication},
+    {"packed_division", packedDivision},
+    {"packed_power_spectrum", packedPowerSpectrum},
+    {"kernel_regularization", kernelRegularization},
+    {"simd_kernels", simdKernels},
+    {"fft_backends", fftBackends},
+    {"fhog", fhog},
+    {"update_policy", updatePolicy},
+    {"motion_model", motionModel},
+    {"mat_pool", matPool},
+    {"color_cache", colorCache},
+};
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0, run = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        bool selected = argc < 2;
+        for (int a = 1; a < argc; a++)
+            selected = selected || strstr(checks[i].name, argv[a]) != NULL;
+        if (!selected)
+            continue;
+        int before = failures;
+        checks[i].run();
+        cout << (failures == before ? "ok     " : "FAILED ") << checks[i].name << endl;
+        failed += failures != before;
+        run++;
+    }
+    cout << run - failed << "/" << run << " checks passed" << endl;
+    return failed ? 1 : 0;
+}
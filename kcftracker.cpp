@@ -86,10 +86,15 @@ the use of this software, even if advised of the possibility of such damage.
 #include "recttools.hpp"
 #include "fhog.hpp"
 #include "labdata.hpp"
+#include "trace.hpp"
 #endif
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
 //#include <windows.h>
 
 
@@ -97,10 +102,53 @@ using namespace std;
 using namespace cv;
 
 
+namespace
+{
+// Accumulates the time since the previous lap into a stage total, does nothing when disabled
+class StageTimer
+{
+public:
+    explicit StageTimer(bool enabled) : _start(enabled ? cv::getTickCount() : 0), _enabled(enabled) {}
+
+    void lap(double &total)
+    {
+        if (!_enabled)
+            return;
+        int64 now = cv::getTickCount();
+        total += (now - _start) * 1000.0 / cv::getTickFrequency();
+        _start = now;
+    }
+
+private:
+    int64 _start;
+    bool _enabled;
+};
+}
+
 // Constructor
 KCFTracker::KCFTracker(bool hog, bool fixed_window, bool multiscale, bool lab)
 {
 	frame_count = 0;
+	peak_value = psr_value = apce_value = 0;
+	last_decision = UPDATE_TRAIN;
+    fast_hog = true;
+    _pyramid = NULL;
+    _debug = NULL;
+    _cache = NULL;
+    _cache_space = ColorCache::GRAY;
+    collect_timings = false;
+    // reuse the detection window only when the target did not move, a shifted window biases the
+    // model towards its old position
+    train_reuse_shift = 0.0f;
+    train_shift_features = false;
+    train_reuse_scale = 0.0f;
+    // Scale filter, off by default
+    scale_filter = false;
+    scale_count = 17;
+    scale_filter_step = 1.04;
+    scale_sigma_factor = 0.25;
+    scale_lr = 0.025;
+    scale_lambda = 0.01;
     // Parameters equal in all cases
     lambda = 0.0001;
     padding = 3.0; 
@@ -183,19 +231,29 @@ bool KCFTracker::init(const cv::Rect &roi, cv::Mat image)
     //assert(roi.width >= 0 && roi.height >= 0);
 
 	getTemplateSize(image);
-    _tmpl = getFeatures(image, 1);
+    _tmpl = getFeatures(image, 1).clone(); // getFeatures() reuses its buffer
 
 	tmpl_original = getgray(image,_roi);
 		
     _prob = createGaussianPeak(size_patch[0], size_patch[1]);
-    _alphaf = cv::Mat(size_patch[0], size_patch[1], CV_32FC2, float(0));
+    _alphaf = cv::Mat(size_patch[0], size_patch[1], CV_32F, float(0)); // packed spectrum
 
     //_num = cv::Mat(size_patch[0], size_patch[1], CV_32FC2, float(0));
     //_den = cv::Mat(size_patch[0], size_patch[1], CV_32FC2, float(0));
 	//cout << "size_patch[0]: "<< size_patch[0] << endl;
 	//cout << "size_patch[1]: "<< size_patch[1] << endl;	
+    _tmplf.release();
     train(_tmpl, 1.0); // train with initial frame
 
+    policy.reset();
+    last_decision = UPDATE_TRAIN;
+    motion.reset(cv::Point2f(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f));
+
+    _scale_num.release();
+    if (scale_filter) {
+        initScaleFilter(image);
+    }
+
 	
 	//hsv histogram
 #if 0
@@ -234,7 +292,7 @@ bool KCFTracker::init(const cv::Rect &roi, cv::Mat image)
 	//hsv histogram for judgement
 	if(_labfeatures)
 	{
-		Mat hsv = img2hsv(image, roi);
+		Mat hsv = _cache ? img2hsv(*_cache, roi) : img2hsv(image, roi);
 		ret = calc_histogram(hsv,&ref_histos);
 		if(!ret)
 			return false;
@@ -251,6 +309,7 @@ cv::Rect  KCFTracker::getRect()
 }
 bool KCFTracker::update(cv::Mat image)
 {
+    KCF_TRACE_SCOPE("KCFTracker::update");
 	cv::Rect_<float> roi_tmp;
     float scale_temp = _scale;
 	
@@ -258,6 +317,25 @@ bool KCFTracker::update(cv::Mat image)
 	{
 		return false; 
 	}
+	StageTimer update_timer(collect_timings);
+	if (collect_timings)
+		timings.updates++;
+	// position before the motion prior moves the search window
+	cv::Point2f previous(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f);
+	if (motion.type != MOTION_NONE)
+	{
+		cv::Point2f predicted = motion.predict();
+		_roi.x = predicted.x - _roi.width / 2.0f;
+		_roi.y = predicted.y - _roi.height / 2.0f;
+	}
+	if (policy.skipDetection())
+	{
+		// stable target, it stays where it is (or where its motion takes it)
+		motion.coast();
+		last_decision = UPDATE_SKIP;
+		update_timer.lap(timings.update);
+		return true;
+	}
     if (_roi.x + _roi.width <= 0) _roi.x = -_roi.width + 1;
     if (_roi.y + _roi.height <= 0) _roi.y = -_roi.height + 1;
     if (_roi.x >= image.cols - 1) _roi.x = image.cols - 2;
@@ -267,26 +345,35 @@ bool KCFTracker::update(cv::Mat image)
     float cx = _roi.x + _roi.width / 2.0f;
     float cy = _roi.y + _roi.height / 2.0f;
 
-	double t = (double)getTickCount();	
     //float peak_value;
-    cv::Point2f res = detect(_tmpl, getFeatures(image, 1.0f), peak_value, psr_value);
-	t = (double)cvGetTickCount() - t;
-	//printf("detect time = %gms\n", t / (cvGetTickFrequency() * 1000));
+    // center and scale of the window the detection is relative to
+    cv::Point2f center(cx, cy);
+    float feature_scale = scale_temp;
+    ResponseStats stats;
+    cv::Point2f res = detect(getDetectionFeatures(image, 1.0f, center, feature_scale), stats, _samples[0]);
 	frame_count++;
-	if(frame_count>=2)
+	if (scale_filter && !_scale_num.empty())
+	{
+		// scale comes from the scale filter below, no extra translation detects
+		frame_count = 0;
+	}
+	else if(frame_count>=2)
 	{
 		//if (scale_step != 1) {
 		{
 			// Test at a smaller _scale
 			float scale_weight_temp = scale_weight*0.9;
-			float new_peak_value; 
-			float new_psr_value;
-			cv::Point2f new_res = detect(_tmpl, getFeatures(image, 1.0f / scale_step), new_peak_value, psr_value);
+			ResponseStats new_stats;
+			cv::Point2f new_center(cx, cy);
+			float new_feature_scale = scale_temp / scale_step;
+			cv::Point2f new_res = detect(getDetectionFeatures(image, 1.0f / scale_step, new_center, new_feature_scale), new_stats, _samples[1]);
 
-			if (scale_weight_temp * new_peak_value > peak_value) {
+			if (scale_weight_temp * new_stats.peak > stats.peak) {
 				res = new_res;
-				peak_value = new_peak_value;
-				psr_value = new_psr_value;
+				center = new_center;
+				feature_scale = new_feature_scale;
+				stats = new_stats;
+				std::swap(_samples[0], _samples[1]);
 				scale_temp /= scale_step;
 				//_roi.width /= scale_step;
 				//_roi.height /= scale_step;
@@ -300,17 +387,20 @@ bool KCFTracker::update(cv::Mat image)
 	}
 	else if (frame_count==1)
 	{
-		float new_peak_value;
-		//cv::Point2f new_res = detect(_tmpl, getFeatures(image,  1.0f / scale_step), new_peak_value);
+		//cv::Point2f new_res = detect(getFeatures(image,  1.0f / scale_step), new_peak_value);
 		// Test at a bigger _scale
-		float new_psr_value;
-		cv::Point2f new_res = detect(_tmpl, getFeatures(image, scale_step), new_peak_value, new_psr_value);
+		ResponseStats new_stats;
+		cv::Point2f new_center(cx, cy);
+		float new_feature_scale = scale_temp * scale_step;
+		cv::Point2f new_res = detect(getDetectionFeatures(image, scale_step, new_center, new_feature_scale), new_stats, _samples[1]);
 	//	cout << "**********" << endl; 
 		float scale_weight_temp = scale_weight*0.93;
-		if (scale_weight_temp * new_peak_value > peak_value) {
+		if (scale_weight_temp * new_stats.peak > stats.peak) {
 			res = new_res;
-			peak_value = new_peak_value;
-			psr_value = new_psr_value;
+			center = new_center;
+			feature_scale = new_feature_scale;
+			stats = new_stats;
+			std::swap(_samples[0], _samples[1]);
 			scale_temp *= scale_step;
 			// _roi.width *= scale_step;
 			//_roi.height *= scale_step;
@@ -319,12 +409,31 @@ bool KCFTracker::update(cv::Mat image)
 			roi_tmp.height *= scale_step;
 		}
 	}
+	peak_value = stats.peak;
+	psr_value = stats.psr;
+	apce_value = stats.apce;
 	//if (roi_tmp.width>155)roi_tmp.width = 155;
 	//if (roi_tmp.height>155)roi_tmp.height = 155;
 //	cout << "roi_tmp.width: " << roi_tmp.width << endl;
     // Adjust by cell size and _scale
-	roi_tmp.x = cx - roi_tmp.width / 2.0f + ((float) res.x * cell_size * scale_temp);
-	roi_tmp.y = cy - roi_tmp.height / 2.0f + ((float) res.y * cell_size * scale_temp);
+	roi_tmp.x = center.x - roi_tmp.width / 2.0f + ((float) res.x * cell_size * feature_scale);
+	roi_tmp.y = center.y - roi_tmp.height / 2.0f + ((float) res.y * cell_size * feature_scale);
+	if (scale_filter && !_scale_num.empty())
+	{
+		// DSST: the scale is estimated at the new position
+		StageTimer timer(collect_timings);
+		cv::Point2f pos(roi_tmp.x + roi_tmp.width / 2.0f, roi_tmp.y + roi_tmp.height / 2.0f);
+		float scale_change = detectScale(image, pos, roi_tmp.width, roi_tmp.height);
+		timer.lap(timings.scale);
+		// the tracker refuses targets smaller than 16 pixels in init(), keep it that way
+		if (roi_tmp.width * scale_change < 16 || roi_tmp.height * scale_change < 16)
+			scale_change = 1;
+		scale_temp *= scale_change;
+		roi_tmp.width *= scale_change;
+		roi_tmp.height *= scale_change;
+		roi_tmp.x = pos.x - roi_tmp.width / 2.0f;
+		roi_tmp.y = pos.y - roi_tmp.height / 2.0f;
+	}
 	if (roi_tmp.x <= 1)roi_tmp.x = 1;
 	if (roi_tmp.y <= 1)roi_tmp.y = 1;
     if (roi_tmp.x >= image.cols - 1) roi_tmp.x = image.cols - 1;
@@ -333,32 +442,25 @@ bool KCFTracker::update(cv::Mat image)
     if (roi_tmp.y + roi_tmp.height <= 0) roi_tmp.y = -roi_tmp.height + 2;
 	if (roi_tmp.x + roi_tmp.width >= image.cols - 1) roi_tmp.x = image.cols - roi_tmp.width -1;
 	if (roi_tmp.y + roi_tmp.height <= 0) roi_tmp.y = image.rows - roi_tmp.height -1;
-//	LARGE_INTEGER nFreq1;
-//	LARGE_INTEGER nBeginTime1;
-//	LARGE_INTEGER nEndTime1;
+	StageTimer check_timer(collect_timings);
 	cv::Mat ncc1(1, 1, CV_32F);
-//	QueryPerformanceFrequency(&nFreq1);
-//	QueryPerformanceCounter(&nBeginTime1);
-
 	cv::Mat tmp = getgray(image, roi_tmp);
-	matchTemplate(tmp, tmpl_original, ncc1, CV_TM_CCOEFF_NORMED);//CV_TM_CCORR
+	matchTemplate(tmp, tmpl_original, ncc1, cv::TM_CCOEFF_NORMED);//cv::TM_CCORR
 	template_sim = (((float*)ncc1.data)[0] + 1)*0.5;
+	check_timer.lap(timings.match);
 	
-	
-
-//	QueryPerformanceCounter(&nEndTime1);
-	//double time = (double)(nEndTime1.QuadPart - nBeginTime1.QuadPart) / (double)nFreq1.QuadPart;
-//	cout << "template matching TimeEnd-TimeStart:" << time << endl;
-	
-	//imshow("x",tmp);
-	//imshow("T", tmpl_original);
+	if (_debug) {
+		_debug->show("x", this, tmp);
+		_debug->show("T", this, tmpl_original);
+	}
 	
 	if(_labfeatures)
 	{
-		Mat hsv = img2hsv(image, roi_tmp);
+		Mat hsv = _cache ? img2hsv(*_cache, roi_tmp) : img2hsv(image, roi_tmp);
 		calc_histogram(hsv,&histos);
 		normalize_histogram(&histos);
 		hist_similarity = histo_dist_sq(&ref_histos,&histos);
+		check_timer.lap(timings.histogram);
 	}
 	else
 	{
@@ -369,109 +471,109 @@ bool KCFTracker::update(cv::Mat image)
 	
 	if (peak_value<0.35 )//|| psr_value <2.3
 	{
+		motion.coast();
+		update_timer.lap(timings.update);
 		return false;
 	}
 	else if ((template_sim>0.68 || (hist_similarity >= 0.7 || peak_value >= 0.45))) //&& psr_value >2.5
 //	else if((template_sim>=0.40)||(hist_similarity>=0.40))
 	{
+		float dx = roi_tmp.x + roi_tmp.width / 2.0f - previous.x;
+		float dy = roi_tmp.y + roi_tmp.height / 2.0f - previous.y;
 	    _roi = roi_tmp;
 		_scale = scale_temp;
 	    assert(_roi.width >= 0 && _roi.height >= 0);
+		motion.correct(cv::Point2f(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f));
 	    
-		
-		//if (psr_value > 3.5)
+		last_decision = policy.decide(psr_value, apce_value, std::sqrt(dx * dx + dy * dy));
+		if (last_decision == UPDATE_TRAIN)
 		{
-			cv::Mat x = getFeatures(image, 1);
-			train(x, interp_factor);
+			// The window of the accepted detection is the training window when it has the
+			// current scale and the target stayed close to its center: train on its features
+			// and spectrum instead of extracting them again. With train_shift_features they are
+			// first moved to the new target position, which allows larger displacements.
+			cv::Point2f target_center(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f);
+			float cells = cell_size * feature_scale;
+			float shift_x = (target_center.x - center.x) / cells;
+			float shift_y = (target_center.y - center.y) / cells;
+			float scale_change = std::fabs(feature_scale - _scale) / _scale;
+			bool close = train_reuse_shift >= 0 && std::fabs(shift_x) <= train_reuse_shift && std::fabs(shift_y) <= train_reuse_shift;
+			bool shift = close && train_shift_features && scale_change <= std::max(train_reuse_scale, 1e-5f) &&
+			             size_patch[0] >= 3 && size_patch[1] >= 3;
+			bool reuse = close && !train_shift_features && scale_change <= 1e-5f;
+			if (shift) {
+				shiftFeatures(_samples[0], center, feature_scale, target_center, _scale, _samples[1]);
+				train(_samples[1], interp_factor);
+			}
+			else if (reuse) {
+				train(_samples[0], interp_factor);
+			}
+			else {
+				cv::Mat x = getFeatures(image, 1);
+				train(x, interp_factor);
+			}
+			if (collect_timings) {
+				timings.trains++;
+				if (shift || reuse)
+					timings.reused_trains++;
+			}
+			if (scale_filter && !_scale_num.empty())
+			{
+				StageTimer timer(collect_timings);
+				cv::Point2f pos(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f);
+				trainScale(image, pos, _roi.width, _roi.height, scale_lr);
+				timer.lap(timings.scale);
+			}
 		}
-
-	//	t = 1000 * ((double)getTickCount() - t) / getTickFrequency();
-	///	cout << "detect time used:" << t << endl;
 	}
 	else
 	{
+		motion.coast();
+		update_timer.lap(timings.update);
 		return false;
 	}
-	
-	
-
+	update_timer.lap(timings.update);
     return true;
 }
 
 
 // Detect object in the current frame.
-cv::Point2f KCFTracker::detect(cv::Mat z, cv::Mat x, float &peak_value, float &psr_value)
+cv::Point2f KCFTracker::detect(cv::Mat x, ResponseStats &stats, FeatureSample &sample)
 {
+    KCF_TRACE_SCOPE("KCFTracker::detect");
     using namespace FFTTools;
 
-	//float peak_value;
-	
-    cv::Mat k = gaussianCorrelation(x, z);
-    cv::Mat res = (real(fftd(complexMultiplication(_alphaf, fftd(k)), true)));
-	Mat res_n; 
-	normalize(res,res_n,255.0,0.0,NORM_MINMAX);
-
-    //minMaxLoc only accepts doubles for the peak, and integer points for the coordinates
-    cv::Point2i pi;
-    double pv;
-    cv::minMaxLoc(res, NULL, &pv, NULL, &pi);
-    peak_value = (float) pv;
-    //subpixel peak estimation, coordinates will be non-integer
-    cv::Point2f p((float)pi.x, (float)pi.y);
-
-	/***********add PSR ********/
-	cv::Point2i pi_n;
-    double pv_n;
-	cv::minMaxLoc(res_n, NULL, &pv_n, NULL, &pi_n);
-	Mat PSR_mask = Mat::zeros(res.rows,res.cols, CV_8U);
-    Scalar mean,stddev;
-	//Define PSR mask
-    int win_size = floor((float)PSR_mask.cols/4);
-	Rect mini_roi = Rect(std::max(pi_n.x - win_size, 0), std::max(pi_n.y - win_size, 0), win_size * 2, win_size * 2);
-	Rect cent_roi = Rect(std::max(pi_n.x - win_size/4, 0), std::max(pi_n.y - win_size/4, 0), win_size/2 , win_size/2 );
-	//Handle image boundaries
-    if ( (mini_roi.x+mini_roi.width) > PSR_mask.cols )
-    {
-        mini_roi.width = PSR_mask.cols - mini_roi.x;
-    }
-    if ( (mini_roi.y+mini_roi.height) > PSR_mask.rows )
-    {
-        mini_roi.height = PSR_mask.rows - mini_roi.y;
-    }
-	if ((cent_roi.x + cent_roi.width) > PSR_mask.cols)
-	{
-		cent_roi.width = PSR_mask.cols - cent_roi.x;
-	}
-	if ((cent_roi.y + cent_roi.height) > PSR_mask.rows)
-	{
-		cent_roi.height = PSR_mask.rows - cent_roi.y;
-	}
-    Mat temp = PSR_mask(mini_roi);
-    temp.setTo( 255);
-	Mat temp_cent = PSR_mask(cent_roi);
-	temp_cent.setTo(0);
-	/*for(int i = 0;i< res.rows; i = i +4 )
-	for (int j = 0; j< res.cols; j = j + 4)
-		{
-			if(sqrt((j-pi_n.x)*(j-pi_n.x)+(i-pi_n.y)*(i-pi_n.y)) < res.rows/3 && sqrt((j-pi_n.x)*(j-pi_n.x)+(i-pi_n.y)*(i-pi_n.y)) > res.rows/8)
-				PSR_mask.at<uchar>(i,j) = 255;
-		}*/
-	//imshow("PSR_mask",PSR_mask);
-	meanStdDev(res_n, mean, stddev, PSR_mask);   //Compute matrix mean and std
-	//cout <<"res_n mean: " << mean <<", stddev: " << stddev<<endl;
-	psr_value = (pv_n - mean.val[0]) / stddev.val[0];
-	//cout << "PSR: " << psr_value << endl;     //Compute PSR
-
-	/*********end add PSR******/
-	//psr_value = 5;
-    if (pi.x > 0 && pi.x < res.cols-1) {
-        p.x += subPixelPeak(res.at<float>(pi.y, pi.x-1), peak_value, res.at<float>(pi.y, pi.x+1));
-    }
-
-    if (pi.y > 0 && pi.y < res.rows-1) {
-        p.y += subPixelPeak(res.at<float>(pi.y-1, pi.x), peak_value, res.at<float>(pi.y+1, pi.x));
+    // the template spectrum only changes in train(), so only x is transformed here
+    StageTimer timer(collect_timings);
+    // kept for train(). When x is in the buffer of the next feature extraction, the sample takes
+    // that buffer and hands its previous one over to the extraction, instead of copying x.
+    sample.x = x;
+    if (x.data == _fhog.features.data)
+        cv::swap(_fhog.features, sample.features);
+    sample.xx = x.dot(x);
+    getSpectra(x, sample.xf);
+    timer.lap(timings.detect_fft);
+    cv::Mat kf = gaussianCorrelation(sample.xf, sample.xx, _tmplf, _tmpl_sq);
+    timer.lap(timings.correlation);
+    fft().forward(kf, kf); // in place
+    complexMultiplicationPacked(_alphaf, kf, kf); // in place, no temporaries
+    cv::Mat res;
+    fft().inverse(kf, res);
+    timer.lap(timings.detect_fft);
+    responseStats(res, stats);
+    timer.lap(timings.psr);
+    if (_debug) {
+        // the views are only built for the sink
+        Mat res_n;
+        normalize(res, res_n, 255.0, 0.0, NORM_MINMAX);
+        _debug->show("response", this, res_n);
+        Mat PSR_mask = Mat::zeros(res.rows, res.cols, CV_8U);
+        PSR_mask(stats.sidelobe).setTo(255);
+        PSR_mask(stats.excluded).setTo(0);
+        _debug->show("PSR_mask", this, PSR_mask);
     }
 
+    cv::Point2f p = stats.location;
     p.x -= (res.cols) / 2;
     p.y -= (res.rows) / 2;
 
@@ -481,13 +583,39 @@ cv::Point2f KCFTracker::detect(cv::Mat z, cv::Mat x, float &peak_value, float &p
 // train tracker with a single image
 void KCFTracker::train(cv::Mat x, float train_interp_factor)
 {
+    _train_sample.x = x;
+    _train_sample.xx = x.dot(x);
+    getSpectra(x, _train_sample.xf);
+    train(_train_sample, train_interp_factor);
+    _train_sample.x.release();
+}
+
+void KCFTracker::train(const FeatureSample &sample, float train_interp_factor)
+{
+    KCF_TRACE_SCOPE("KCFTracker::train");
     using namespace FFTTools;
 
-    cv::Mat k = gaussianCorrelation(x, x);
-    cv::Mat alphaf = complexDivision(_prob, (fftd(k) + lambda));
-    
-    _tmpl = (1 - train_interp_factor) * _tmpl + (train_interp_factor) * x;
-    _alphaf = (1 - train_interp_factor) * _alphaf + (train_interp_factor) * alphaf;
+    StageTimer timer(collect_timings);
+    cv::Mat alphaf = gaussianAutoCorrelation(sample.xf, sample.xx);
+    timer.lap(timings.correlation);
+    // fft(k) + lambda in packed layout
+    fft().forward(alphaf, alphaf); // in place
+    regularizeKernelSpectrumPacked(alphaf, lambda);
+    complexDivisionPacked(_prob, alphaf, alphaf); // in place, no temporaries
+
+    // model blended in place
+    cv::addWeighted(_tmpl, 1 - train_interp_factor, sample.x, train_interp_factor, 0, _tmpl);
+    cv::addWeighted(_alphaf, 1 - train_interp_factor, alphaf, train_interp_factor, 0, _alphaf);
+
+    // The FFT is linear, so the template spectrum is interpolated in the frequency domain
+    // instead of transforming the new _tmpl again on every detect().
+    if (_tmplf.size() != sample.xf.size()) {
+        sample.xf.copyTo(_tmplf);
+    }
+    else {
+        cv::addWeighted(_tmplf, 1 - train_interp_factor, sample.xf, train_interp_factor, 0, _tmplf);
+    }
+    _tmpl_sq = _tmpl.dot(_tmpl);
 
 
     /*cv::Mat kf = fftd(gaussianCorrelation(x, x));
@@ -502,43 +630,122 @@ void KCFTracker::train(cv::Mat x, float train_interp_factor)
 
 }
 
-// Evaluates a Gaussian kernel with bandwidth SIGMA for all relative shifts between input images X and Y, which must both be MxN. They must    also be periodic (ie., pre-processed with a cosine window).
-cv::Mat KCFTracker::gaussianCorrelation(cv::Mat x1, cv::Mat x2)
+// Forward FFT of every feature channel of X, in packed CCS layout. All channels share one buffer.
+void KCFTracker::getSpectra(const cv::Mat &x, cv::Mat &xf)
 {
     using namespace FFTTools;
-    cv::Mat c = cv::Mat( cv::Size(size_patch[1], size_patch[0]), CV_32F, cv::Scalar(0) );
-    // HOG features
+    xf.create(size_patch[0] * size_patch[2], size_patch[1], CV_32F);
+    // HOG features, all planes in one batch
     if (_hogfeatures) {
-        cv::Mat caux;
-        cv::Mat x1aux;
-        cv::Mat x2aux;
-        for (int i = 0; i < size_patch[2]; i++) {
-            x1aux = x1.row(i);   // Procedure do deal with cv::Mat multichannel bug
-            x1aux = x1aux.reshape(1, size_patch[0]);
-            x2aux = x2.row(i).reshape(1, size_patch[0]);
-            cv::mulSpectrums(fftd(x1aux), fftd(x2aux), caux, 0, true); 
-            caux = fftd(caux, true);
-            rearrange(caux);
-            caux.convertTo(caux,CV_32F);
-            c = c + real(caux);
-        }
+        fft().forwardPlanes(x, xf);
     }
     // Gray features
     else {
-        cv::mulSpectrums(fftd(x1), fftd(x2), c, 0, true);
-        c = fftd(c, true);
-        rearrange(c);
-        c = real(c);
+        fft().forward(x, xf);
     }
-    cv::Mat d; 
-    cv::max(( (cv::sum(x1.mul(x1))[0] + cv::sum(x2.mul(x2))[0])- 2. * c) / (size_patch[0]*size_patch[1]*size_patch[2]) , 0, d);
+}
 
+// Evaluates a Gaussian kernel with bandwidth SIGMA for all relative shifts between input images X and Y, which must both be MxN. They must    also be periodic (ie., pre-processed with a cosine window).
+cv::Mat KCFTracker::gaussianCorrelation(const cv::Mat &x1f, double x1sq, const cv::Mat &x2f, double x2sq)
+{
+    using namespace FFTTools;
+    // The inverse FFT is linear, so the cross-power spectra of all channels are summed in the
+    // frequency domain and only one inverse transform is needed.
+    complexMultiplicationPacked(x1f.rowRange(0, size_patch[0]), x2f.rowRange(0, size_patch[0]), _xyf, true);
+    for (int i = 1; i < size_patch[2]; i++) {
+        int r0 = i * size_patch[0];
+        complexMultiplicationPacked(x1f.rowRange(r0, r0 + size_patch[0]), x2f.rowRange(r0, r0 + size_patch[0]), _caux, true);
+        _xyf += _caux;
+    }
+    return gaussianKernel(_xyf, x1sq + x2sq);
+}
+
+// The cross-power spectrum of X with itself is its power spectrum, which is real: no complex
+// products, and no imaginary parts to sum.
+cv::Mat KCFTracker::gaussianAutoCorrelation(const cv::Mat &xf, double xsq)
+{
+    using namespace FFTTools;
+    _xyf.setTo(0);
+    for (int i = 0; i < size_patch[2]; i++) {
+        int r0 = i * size_patch[0];
+        accumulatePowerSpectrumPacked(xf.rowRange(r0, r0 + size_patch[0]), _xyf);
+    }
+    return gaussianKernel(_xyf, 2 * xsq);
+}
 
-    cv::Mat k;
-    cv::exp((-d / (sigma * sigma)), k);
+cv::Mat KCFTracker::gaussianKernel(const cv::Mat &xyf, double sq)
+{
+    using namespace FFTTools;
+    cv::Mat k = _k;
+    fft().inverse(xyf, k);
+    rearrange(k, _quadrant);
+
+    // k = exp(-max(sq - 2 c, 0) / N / sigma^2), in place
+    double n = size_patch[0] * size_patch[1] * size_patch[2];
+    k.convertTo(k, CV_32F, -2. / n, sq / n);
+    cv::max(k, 0, k);
+    k.convertTo(k, CV_32F, -1. / (sigma * sigma));
+    cv::exp(k, k);
     return k;
 }
 
+// The detection features carry the hann window of the detection, which is divided out and
+// applied again at the new position. The window is zero on the border cells, so samples come
+// from the inner cells only, the outer ones replicated from them: the cells that move in from
+// outside the detection window get the values of its edge, where the new window is small.
+void KCFTracker::shiftFeatures(const FeatureSample &sample, const cv::Point2f &center, float feature_scale,
+                               const cv::Point2f &target_center, float target_scale, FeatureSample &dst)
+{
+    KCF_TRACE_SCOPE("KCFTracker::shiftFeatures");
+    StageTimer timer(collect_timings);
+    int rows = size_patch[0], cols = size_patch[1], channels = size_patch[2];
+    float step = cell_size * feature_scale;
+    float ratio = target_scale / feature_scale;
+    float sx = (target_center.x - center.x) / step;
+    float sy = (target_center.y - center.y) / step;
+
+    // source cell and weight of the next one for every column and row, on the inner cells
+    std::vector<int> x0(cols), y0(rows);
+    std::vector<float> wx(cols), wy(rows);
+    for (int c = 0; c < cols; c++) {
+        float u = cols * 0.5f + (c - cols * 0.5f) * ratio + sx;
+        u = std::min(std::max(u, 1.0f), cols - 2.0f);
+        x0[c] = std::min((int)u, cols - 3);
+        wx[c] = u - x0[c];
+    }
+    for (int r = 0; r < rows; r++) {
+        float v = rows * 0.5f + (r - rows * 0.5f) * ratio + sy;
+        v = std::min(std::max(v, 1.0f), rows - 2.0f);
+        y0[r] = std::min((int)v, rows - 3);
+        wy[r] = v - y0[r];
+    }
+
+    // gray features are one rows x cols plane, HOG ones one plane per row
+    cv::Mat src = sample.x.reshape(1, channels);
+    dst.x.create(sample.x.size(), CV_32F);
+    cv::Mat out = dst.x.reshape(1, channels);
+    const float *window = hann.ptr<float>();
+    const float *inv = _hann_inv.ptr<float>();
+    for (int ch = 0; ch < channels; ch++) {
+        const float *plane = src.ptr<float>(ch);
+        float *res = out.ptr<float>(ch);
+        for (int r = 0; r < rows; r++) {
+            int i0 = y0[r] * cols, i1 = i0 + cols;
+            for (int c = 0; c < cols; c++) {
+                int a = i0 + x0[c], b = i1 + x0[c];
+                float top = plane[a] * inv[a] * (1 - wx[c]) + plane[a + 1] * inv[a + 1] * wx[c];
+                float bottom = plane[b] * inv[b] * (1 - wx[c]) + plane[b + 1] * inv[b + 1] * wx[c];
+                int k = r * cols + c;
+                res[k] = window[k] * (top * (1 - wy[r]) + bottom * wy[r]);
+            }
+        }
+    }
+    timer.lap(timings.features);
+
+    dst.xx = dst.x.dot(dst.x);
+    getSpectra(dst.x, dst.xf);
+}
+
 // Create Gaussian Peak. Function called only in the first frame.
 cv::Mat KCFTracker::createGaussianPeak(int sizey, int sizex)
 {
@@ -557,20 +764,36 @@ cv::Mat KCFTracker::createGaussianPeak(int sizey, int sizex)
 		int jh = j - sxh;
 		res(i, j) = std::exp(mult * (float)(ih * ih + jh * jh));
 	}
-	return FFTTools::fftd(res);
+	cv::Mat resf;
+	fft().forward(res, resf);
+	return resf;
+}
+
+FFTTools::FFTPlan &KCFTracker::fft()
+{
+    if (_fft.plan == NULL)
+        _fft.plan = FFTTools::getBackend().createPlan(size_patch[0], size_patch[1], size_patch[2]);
+    return *_fft.plan;
+}
+
+bool KCFTracker::setFFTBackend(const std::string &name)
+{
+    return FFTTools::setBackend(name);
+}
+
+void FFTPlanHandle::reset()
+{
+    delete plan;
+    plan = NULL;
 }
 // Obtain sub-window from image
 cv::Mat KCFTracker::getgray(const cv::Mat & image,cv::Rect_<float> roi)
 {
 
     cv::Mat FeaturesMap;  
-    cv::Mat z = RectTools::subwindow(image, roi, cv::BORDER_REPLICATE);
-    
-    if (z.cols != _tmpl_sz.width || z.rows != _tmpl_sz.height) {
-        cv::resize(z, z, _tmpl_sz);
-    }   
-
-    FeaturesMap = RectTools::getGrayImage(z);
+    // crop, resize and conversion to [0, 1] floats in one pass
+    prepareWindow(roi);
+    RectTools::sampleWindow(image, roi, _tmpl_sz, FeaturesMap, _taps, CV_32F, 1 / 255.f);
     //FeaturesMap -= (float) 0.5; // In Paper;
     
     //FeaturesMap = hann.mul(FeaturesMap);
@@ -580,7 +803,8 @@ cv::Mat KCFTracker::getgray(const cv::Mat & image,cv::Rect_<float> roi)
 // Obtain sub-window from image, with replication-padding and extract features
 cv::Mat KCFTracker::getFeatures(const cv::Mat & image, float scale_adjust)
  {
-
+    KCF_TRACE_SCOPE("KCFTracker::getFeatures");
+    StageTimer timer(collect_timings);
 
     cv::Rect extracted_roi;
 
@@ -602,36 +826,43 @@ cv::Mat KCFTracker::getFeatures(const cv::Mat & image, float scale_adjust)
 //	cout << "image width:" << image.cols << "image height:" << image.rows << endl;
 //  double t = (double)getTickCount();
 	cv::Mat FeaturesMap;  
-    cv::Mat z = RectTools::subwindow(image, extracted_roi, cv::BORDER_REPLICATE);
-//	t = (double)cvGetTickCount() - t;
+//	t = (double)getTickCount() - t;
 //	printf("FeaturesMap time = %gms\n", t / (cvGetTickFrequency() * 1000));
-    if (z.cols != _tmpl_sz.width || z.rows != _tmpl_sz.height) {
-        cv::resize(z, z, _tmpl_sz);
-    }   
 	
     // HOG features
     if (_hogfeatures) {
-        IplImage z_ipl = z;
-        CvLSVMFeatureMapCaskade *map;
-        getFeatureMaps(&z_ipl, cell_size, &map);
-        normalizeAndTruncate(map,0.2f);
-        PCAFeatureMaps(map);
-        //size_patch[0] = map->sizeY;
-        //size_patch[1] = map->sizeX;
-        //size_patch[2] = map->numFeatures;
-
-        FeaturesMap = cv::Mat(cv::Size(map->numFeatures,map->sizeX*map->sizeY), CV_32F, map->map);  // Procedure do deal with cv::Mat multichannel bug
-        FeaturesMap = FeaturesMap.t();
-        freeFeatureMapObject(&map);
+        // crop and resize in one pass, into the buffer kept for it
+        prepareWindow(extracted_roi);
+        RectTools::sampleWindow(image, extracted_roi, _tmpl_sz, _fhog.patch, _taps);
+        cv::Mat z = _fhog.patch;
+        IplImage z_ipl = fhogIplImage(z);
+        FHogWorkspace *ws = _fhog.ws;
+        if (ws == NULL || ws->width != z.cols || ws->height != z.rows || ws->numChannels != z.channels()) {
+            freeFHogWorkspace(&_fhog.ws);
+            allocFHogWorkspace(&_fhog.ws, z.cols, z.rows, cell_size, z.channels());
+            ws = _fhog.ws;
+        }
+        int cells = size_patch[0] * size_patch[1];
+        if (_fhog.features.rows != size_patch[2] || _fhog.features.cols < cells) {
+            _fhog.features.create(size_patch[2], cv::alignSize(cells, 8), CV_32F);
+        }
+        if (fast_hog)
+            getFeatureMapsFast(&z_ipl, ws);
+        else
+            getFeatureMaps(&z_ipl, ws);
+        // fhog writes the windowed channel planes straight into the rows of the feature buffer
+        normalizeAndPCAFeaturePlanes(ws, 0.2f, _fhog.features.ptr<float>(), (int)_fhog.features.step1(), hann.ptr<float>());
+        FeaturesMap = _fhog.features.colRange(0, cells);
 
-        // Lab features
-        if (_labfeatures) {
+        // Lab features, none while no centroids are loaded
+        if (_labfeatures && !_labCentroids.empty()) {
             cv::Mat imgLab;
-            cvtColor(z, imgLab, CV_BGR2Lab);
+            cvtColor(z, imgLab, cv::COLOR_BGR2Lab);
             unsigned char *input = (unsigned char*)(imgLab.data);
 
-            // Sparse output vector
-            cv::Mat outputLab = cv::Mat(_labCentroids.rows, size_patch[0]*size_patch[1], CV_32F, float(0));
+            // Sparse output vector, the rows after the HOG planes
+            cv::Mat outputLab = FeaturesMap.rowRange(size_patch[2] - _labCentroids.rows, size_patch[2]);
+            outputLab.setTo(0);
 
             int cntCell = 0;
             // Iterate through each cell
@@ -666,31 +897,89 @@ cv::Mat KCFTracker::getFeatures(const cv::Mat & image, float scale_adjust)
                     cntCell++;
                 }
             }
-            // Update size_patch[2] and add features to FeaturesMap
-            //size_patch[2] += _labCentroids.rows;
-            FeaturesMap.push_back(outputLab);
+            for (int i = 0; i < outputLab.rows; i++) {
+                cv::Mat row = outputLab.row(i);
+                cv::multiply(row, hann, row);
+            }
         }
     }
     else {
-        FeaturesMap = RectTools::getGrayImage(z);
-        FeaturesMap -= (float) 0.5; // In Paper;
+        // gray levels in [-0.5, 0.5]
+        prepareWindow(extracted_roi);
+        RectTools::sampleWindow(image, extracted_roi, _tmpl_sz, FeaturesMap, _taps, CV_32F, 1 / 255.f, -0.5f); // -0.5 In Paper;
         //size_patch[0] = z.rows;
         //size_patch[1] = z.cols;
         //size_patch[2] = 1;  
+        FeaturesMap = hann.mul(FeaturesMap);
     }
   //  cout << "FeaturesMap rows: "<<FeaturesMap.rows << " FeaturesMap cols: "<<FeaturesMap.cols<<endl;
-    FeaturesMap = hann.mul(FeaturesMap);
-	imshow("FeaturesMap",FeaturesMap);
+    timer.lap(timings.features);
+    if (_debug)
+        _debug->show("FeaturesMap", this, FeaturesMap);
     return FeaturesMap;
 }
 
+cv::Mat KCFTracker::getDetectionFeatures(const cv::Mat & image, float scale_adjust, cv::Point2f &center, float &feature_scale)
+{
+    if (_pyramid != NULL && _hogfeatures && !_labfeatures) {
+        KCF_TRACE_SCOPE("KCFTracker::sampleFeatures");
+        StageTimer timer(collect_timings);
+        int cells = size_patch[0] * size_patch[1];
+        if (_fhog.features.rows != size_patch[2] || _fhog.features.cols < cells) {
+            _fhog.features.create(size_patch[2], cv::alignSize(cells, 8), CV_32F);
+        }
+        cv::Point2f used_center;
+        float used_scale;
+        cv::Point2f roi_center(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f);
+        if (_pyramid->sample(roi_center, _tmpl_sz, _scale * scale_adjust, hann, _fhog.features, used_center, used_scale)) {
+            center = used_center;
+            feature_scale = used_scale;
+            timer.lap(timings.features);
+            return _fhog.features.colRange(0, cells);
+        }
+    }
+    return getFeatures(image, scale_adjust);
+}
+
+void KCFTracker::setFeaturePyramid(const FeaturePyramid *pyramid)
+{
+    _pyramid = pyramid;
+}
+
+void KCFTracker::setDebugSink(DebugSink *sink)
+{
+    _debug = sink;
+}
+
+void KCFTracker::setColorCache(const ColorCache *cache, ColorCache::Space space)
+{
+    _cache = cache;
+    _cache_space = space;
+}
+
+void KCFTracker::prepareWindow(const cv::Rect_<float> &window) const
+{
+    if (_cache)
+        _cache->ensure(_cache_space, window);
+}
+
+void KCFTracker::requireFeatures(FeaturePyramid &pyramid) const
+{
+    if (!_hogfeatures || _labfeatures)
+        return;
+    // update() probes at most one other scale per frame, both are announced, around the
+    // position the motion prior will search at
+    cv::Point2f roi_center(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f);
+    if (motion.type != MOTION_NONE)
+        roi_center = motion.predict();
+    pyramid.require(roi_center, _tmpl_sz, _scale);
+    pyramid.require(roi_center, _tmpl_sz, _scale / scale_step);
+    pyramid.require(roi_center, _tmpl_sz, _scale * scale_step);
+}
+
 // Obtain sub-window from image, with replication-padding and extract features
 void KCFTracker::getTemplateSize(const cv::Mat & image)
  {
-    cv::Rect extracted_roi;
-
-    float cx = _roi.x + _roi.width / 2;
-    float cy = _roi.y + _roi.height / 2;
 
     int padded_w = _roi.width * padding;
     int padded_h = _roi.height * padding;
@@ -753,12 +1042,24 @@ void KCFTracker::getTemplateSize(const cv::Mat & image)
             // Update size_patch[2] and add features to FeaturesMap
             size_patch[2] += _labCentroids.rows;
         }
+
+        // Buffers of getFeatures(), every extraction has the template size
+        freeFHogWorkspace(&_fhog.ws);
+        allocFHogWorkspace(&_fhog.ws, _tmpl_sz.width, _tmpl_sz.height, cell_size, image.channels());
+        _fhog.features.create(size_patch[2], cv::alignSize(size_patch[0] * size_patch[1], 8), CV_32F);
     }
     else {
         size_patch[0] = _tmpl_sz.height;
         size_patch[1] = _tmpl_sz.width;
         size_patch[2] = 1;  
     }
+
+    // FFT plan and buffers of the kernel correlations, every window has the template size
+    _fft.reset();
+    _xyf.create(size_patch[0], size_patch[1], CV_32F);
+    _caux.create(size_patch[0], size_patch[1], CV_32F);
+    _k.create(size_patch[0], size_patch[1], CV_32F);
+    _quadrant.create(size_patch[0] / 2, size_patch[1] / 2, CV_32F);
     
     createHanningMats();
 }
@@ -828,7 +1129,7 @@ cv::Mat KCFTracker::getFeatures(const cv::Mat & image, bool inithann, float scal
 
     // HOG features
     if (_hogfeatures) {
-        IplImage z_ipl = z;
+        IplImage z_ipl = fhogIplImage(z);
         CvLSVMFeatureMapCaskade *map;
         getFeatureMaps(&z_ipl, cell_size, &map);
         normalizeAndTruncate(map,0.2f);
@@ -844,7 +1145,7 @@ cv::Mat KCFTracker::getFeatures(const cv::Mat & image, bool inithann, float scal
         // Lab features
         if (_labfeatures) {
             cv::Mat imgLab;
-            cvtColor(z, imgLab, CV_BGR2Lab);
+            cvtColor(z, imgLab, cv::COLOR_BGR2Lab);
             unsigned char *input = (unsigned char*)(imgLab.data);
 
             // Sparse output vector
@@ -915,15 +1216,15 @@ void KCFTracker::createHanningMats()
         hann2t.at<float > (i, 0) = 0.5 * (1 - std::cos(2 * 3.14159265358979323846 * i / (hann2t.rows - 1)));
 
     cv::Mat hann2d = hann2t * hann1t;
+    _hann_inv.create(1, (int)hann2d.total(), CV_32F);
+    const float *h = hann2d.ptr<float>();
+    float *inv = _hann_inv.ptr<float>();
+    for (int i = 0; i < (int)hann2d.total(); i++)
+        inv[i] = h[i] > 0 ? 1.0f / h[i] : 0.0f;
     // HOG features
     if (_hogfeatures) {
-        cv::Mat hann1d = hann2d.reshape(1,1); // Procedure do deal with cv::Mat multichannel bug
-        hann = cv::Mat(cv::Size(size_patch[0]*size_patch[1], size_patch[2]), CV_32F, cv::Scalar(0));
-        for (int i = 0; i < size_patch[2]; i++) {
-            for (int j = 0; j<size_patch[0]*size_patch[1]; j++) {
-                hann.at<float>(i,j) = hann1d.at<float>(0,j);
-            }
-        }
+        // One weight per cell, fhog applies it to every channel plane
+        hann = hann2d.reshape(1,1);
     }
     // Gray features
     else {
@@ -931,6 +1232,81 @@ void KCFTracker::createHanningMats()
     }
 }
 
+// The PSR used to be computed on the response normalized to [0, 255], with a mask of the
+// sidelobe window; PSR does not change under that normalization, so it is computed on the
+// response itself. The windows are the same: a square of twice a quarter of the response
+// width starting at the peak minus that quarter, without a square of half of it around the
+// peak, both clipped at the response border.
+void KCFTracker::responseStats(const cv::Mat &res, ResponseStats &stats)
+{
+    CV_Assert(res.type() == CV_32F);
+
+    // whole response: peak (first maximum, like minMaxLoc), minimum and energy
+    float vmax = -FLT_MAX, vmin = FLT_MAX;
+    cv::Point2i pi(0, 0);
+    double sum = 0, sum_sq = 0;
+    for (int y = 0; y < res.rows; y++) {
+        const float *row = res.ptr<float>(y);
+        for (int x = 0; x < res.cols; x++) {
+            float v = row[x];
+            if (v > vmax) {
+                vmax = v;
+                pi = cv::Point2i(x, y);
+            }
+            vmin = std::min(vmin, v);
+            sum += v;
+            sum_sq += (double)v * v;
+        }
+    }
+    double n = (double)res.total();
+    double energy = sum_sq / n - 2.0 * vmin * sum / n + (double)vmin * vmin; // mean((res - min)^2)
+    stats.peak = vmax;
+    stats.apce = energy > 0 ? (float)((double)(vmax - vmin) * (vmax - vmin) / energy) : 0;
+
+    stats.location = cv::Point2f((float)pi.x, (float)pi.y);
+    if (pi.x > 0 && pi.x < res.cols-1)
+        stats.location.x += subPixelPeak(res.at<float>(pi.y, pi.x-1), vmax, res.at<float>(pi.y, pi.x+1));
+    if (pi.y > 0 && pi.y < res.rows-1)
+        stats.location.y += subPixelPeak(res.at<float>(pi.y-1, pi.x), vmax, res.at<float>(pi.y+1, pi.x));
+
+    cv::Rect bounds(0, 0, res.cols, res.rows);
+    int win_size = res.cols / 4;
+    stats.sidelobe = cv::Rect(std::max(pi.x - win_size, 0), std::max(pi.y - win_size, 0), win_size * 2, win_size * 2) & bounds;
+    stats.excluded = cv::Rect(std::max(pi.x - win_size / 4, 0), std::max(pi.y - win_size / 4, 0), win_size / 2, win_size / 2) & stats.sidelobe;
+
+    // sidelobe window, skipping the excluded columns on the rows that cross it
+    const cv::Rect &side = stats.sidelobe;
+    const cv::Rect &excl = stats.excluded;
+    double side_sum = 0, side_sq = 0;
+    int count = 0;
+    for (int y = side.y; y < side.y + side.height; y++) {
+        const float *row = res.ptr<float>(y);
+        bool crossed = y >= excl.y && y < excl.y + excl.height && excl.width > 0;
+        int gap0 = crossed ? excl.x : side.x + side.width;
+        int gap1 = crossed ? excl.x + excl.width : side.x + side.width;
+        for (int x = side.x; x < gap0; x++) {
+            side_sum += row[x];
+            side_sq += (double)row[x] * row[x];
+        }
+        for (int x = gap1; x < side.x + side.width; x++) {
+            side_sum += row[x];
+            side_sq += (double)row[x] * row[x];
+        }
+        count += (gap0 - side.x) + (side.x + side.width - gap1);
+    }
+    if (count > 0) {
+        double mean = side_sum / count;
+        double var = std::max(side_sq / count - mean * mean, 0.0);
+        stats.sidelobe_mean = (float)mean;
+        stats.sidelobe_std = (float)std::sqrt(var);
+    }
+    else {
+        stats.sidelobe_mean = vmax;
+        stats.sidelobe_std = 0;
+    }
+    stats.psr = stats.sidelobe_std > 0 ? (vmax - stats.sidelobe_mean) / stats.sidelobe_std : 0;
+}
+
 // Calculate sub-pixel peak for one dimension
 float KCFTracker::subPixelPeak(float left, float center, float right)
 {   
@@ -941,3 +1317,137 @@ float KCFTracker::subPixelPeak(float left, float center, float right)
     
     return 0.5 * (right - left) / divisor;
 }
+
+// Initialize the scale filter on the target of init(). Function called only in the first frame.
+void KCFTracker::initScaleFilter(const cv::Mat & image)
+{
+    // Samples are resized to at most 512 pixels, like in DSST
+    float model_factor = 1;
+    if (_roi.width * _roi.height > 512)
+        model_factor = std::sqrt(512 / (_roi.width * _roi.height));
+    _scale_model_sz.width = (int)(_roi.width * model_factor);
+    _scale_model_sz.height = (int)(_roi.height * model_factor);
+    if (_hogfeatures) {
+        // whole cells, and at least one cell left after normalization
+        _scale_model_sz.width = std::max(_scale_model_sz.width / cell_size, 3) * cell_size;
+        _scale_model_sz.height = std::max(_scale_model_sz.height / cell_size, 3) * cell_size;
+    }
+
+    _scale_factors.resize(scale_count);
+    _scale_window.create(1, scale_count, CV_32F);
+    cv::Mat ys(1, scale_count, CV_32F);
+    float scale_sigma = scale_sigma_factor * std::sqrt((float)scale_count);
+    for (int i = 0; i < scale_count; i++) {
+        float ss = i - (scale_count - 1) / 2.0f;
+        _scale_factors[i] = std::pow(scale_filter_step, ss);
+        ys.at<float>(0, i) = std::exp(-0.5f * ss * ss / (scale_sigma * scale_sigma));
+        _scale_window.at<float>(0, i) = 0.5 * (1 - std::cos(2 * 3.14159265358979323846 * (i + 1) / (scale_count + 1)));
+    }
+    cv::dft(ys, _scale_yf, cv::DFT_COMPLEX_OUTPUT);
+
+    cv::Point2f pos(_roi.x + _roi.width / 2.0f, _roi.y + _roi.height / 2.0f);
+    trainScale(image, pos, _roi.width, _roi.height, 1.0);
+}
+
+void KCFTracker::getScaleSpectra(const cv::Mat & image, const cv::Point2f &pos, float width, float height, cv::Mat &xsf)
+{
+    int cells = (_scale_model_sz.width / cell_size - 2) * (_scale_model_sz.height / cell_size - 2);
+    int features = _hogfeatures ? cells * (NUM_SECTOR * 3 + 4) : _scale_model_sz.area();
+
+    // one scale sample per row
+    cv::Mat xs(scale_count, features, CV_32F);
+    _scale_taps.resize(scale_count);
+    for (int i = 0; i < scale_count; i++) {
+        float w = width * _scale_factors[i];
+        float h = height * _scale_factors[i];
+        cv::Rect_<float> window(pos.x - w / 2, pos.y - h / 2, w, h);
+        prepareWindow(window);
+
+        if (_hogfeatures) {
+            RectTools::sampleWindow(image, window, _scale_model_sz, _scale_fhog.patch, _scale_taps[i]);
+            cv::Mat z = _scale_fhog.patch;
+            IplImage z_ipl = fhogIplImage(z);
+            FHogWorkspace *ws = _scale_fhog.ws;
+            if (ws == NULL || ws->width != z.cols || ws->height != z.rows || ws->numChannels != z.channels()) {
+                freeFHogWorkspace(&_scale_fhog.ws);
+                allocFHogWorkspace(&_scale_fhog.ws, z.cols, z.rows, cell_size, z.channels());
+                ws = _scale_fhog.ws;
+            }
+            if (fast_hog)
+                getFeatureMapsFast(&z_ipl, ws);
+            else
+                getFeatureMaps(&z_ipl, ws);
+            // the planes of one sample, back to back, are its row
+            normalizeAndPCAFeaturePlanes(ws, 0.2f, xs.ptr<float>(i), cells, NULL);
+        }
+        else {
+            // sampled straight into the row
+            cv::Mat row = xs.row(i).reshape(1, _scale_model_sz.height);
+            RectTools::sampleWindow(image, window, _scale_model_sz, row, _scale_taps[i], CV_32F, 1 / 255.f, -0.5f);
+        }
+        cv::Mat row = xs.row(i);
+        row *= _scale_window.at<float>(0, i);
+    }
+
+    // FFT over the samples of every feature
+    cv::Mat xst = xs.t();
+    cv::dft(xst, xsf, cv::DFT_ROWS | cv::DFT_COMPLEX_OUTPUT);
+}
+
+float KCFTracker::detectScale(const cv::Mat & image, const cv::Point2f &pos, float width, float height)
+{
+    KCF_TRACE_SCOPE("KCFTracker::detectScale");
+    cv::Mat xsf;
+    getScaleSpectra(image, pos, width, height, xsf);
+
+    // response = ifft(sum over features of num .* xsf / (den + lambda))
+    cv::Mat prod;
+    cv::mulSpectrums(_scale_num, xsf, prod, cv::DFT_ROWS);
+    cv::Mat resf(1, scale_count, CV_32FC2, cv::Scalar(0));
+    cv::Vec2f *r = resf.ptr<cv::Vec2f>();
+    for (int f = 0; f < prod.rows; f++) {
+        const cv::Vec2f *p = prod.ptr<cv::Vec2f>(f);
+        for (int i = 0; i < scale_count; i++)
+            r[i] += p[i];
+    }
+    const float *den = _scale_den.ptr<float>();
+    for (int i = 0; i < scale_count; i++)
+        r[i] *= 1.0f / (den[i] + scale_lambda);
+    cv::dft(resf, resf, cv::DFT_INVERSE | cv::DFT_SCALE);
+
+    int best = 0;
+    for (int i = 1; i < scale_count; i++) {
+        if (r[i][0] > r[best][0])
+            best = i;
+    }
+    return _scale_factors[best];
+}
+
+void KCFTracker::trainScale(const cv::Mat & image, const cv::Point2f &pos, float width, float height, float train_interp_factor)
+{
+    KCF_TRACE_SCOPE("KCFTracker::trainScale");
+    cv::Mat xsf;
+    getScaleSpectra(image, pos, width, height, xsf);
+
+    if (_scale_ysf.rows != xsf.rows) {
+        cv::repeat(_scale_yf, xsf.rows, 1, _scale_ysf);
+    }
+    cv::Mat num;
+    cv::mulSpectrums(_scale_ysf, xsf, num, cv::DFT_ROWS, true); // ysf .* conj(xsf)
+    cv::Mat den(1, scale_count, CV_32F, cv::Scalar(0));
+    float *d = den.ptr<float>();
+    for (int f = 0; f < xsf.rows; f++) {
+        const cv::Vec2f *x = xsf.ptr<cv::Vec2f>(f);
+        for (int i = 0; i < scale_count; i++)
+            d[i] += x[i][0] * x[i][0] + x[i][1] * x[i][1];
+    }
+
+    if (_scale_num.empty() || train_interp_factor >= 1) {
+        _scale_num = num;
+        _scale_den = den;
+    }
+    else {
+        _scale_num = (1 - train_interp_factor) * _scale_num + train_interp_factor * num;
+        _scale_den = (1 - train_interp_factor) * _scale_den + train_interp_factor * den;
+    }
+}
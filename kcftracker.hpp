@@ -31,6 +31,13 @@ Their values can be customized further before calling init():
     template_size: template size in pixels, 0 to use ROI size
     scale_step: scale step for multi-scale estimation, 1 to disable it
     scale_weight: to downweight detection scores of other scales for added stability
+    fast_hog: compute HOG cells with getFeatureMapsFast (same features for 8-bit images), otherwise with getFeatureMaps
+    scale_filter: estimate scale with a separate 1-D scale filter (DSST) every frame instead of
+        alternating one extra translation detect at 1/scale_step and scale_step
+    scale_count, scale_filter_step: number and ratio of the scale samples of the scale filter
+    scale_sigma_factor, scale_lr, scale_lambda: label bandwidth, learning rate and regularization
+        of the scale filter
+    collect_timings: accumulate the time of the stages of update() in timings (off by default)
 
 For speed, the value (template_size/cell_size) should be a power of 2 or a product of small prime numbers.
 
@@ -88,6 +95,84 @@ the use of this software, even if advised of the possibility of such damage.
 #define _OPENCV_KCFTRACKER_HPP_
 #endif
 #include "hsvhist.h"
+#include "fhog.hpp"
+#include "featurepyramid.hpp"
+#include "recttools.hpp"
+#include "debugsink.hpp"
+#include "colorcache.hpp"
+#include "updatepolicy.hpp"
+#include "motionmodel.hpp"
+
+// Time spent in the stages of the tracker, in milliseconds, accumulated while collect_timings is set
+struct KCFStageTimes
+{
+    int updates;        // calls to update()
+    double update;      // whole update()
+    double features;    // feature windows, extracted or sampled from the pyramid
+    double correlation; // gaussianCorrelation, in detect and train
+    double detect_fft;  // spectrum of the window and response FFTs in detect
+    double psr;         // response statistics: peak, PSR and APCE
+    double match;       // gray window and matchTemplate against the initial template
+    double histogram;   // HSV histogram check (Lab only)
+    double scale;       // scale filter detect and train
+    int trains;         // model updates after an accepted detection
+    int reused_trains;  // ...of which trained on the detection features instead of extracting them
+
+    KCFStageTimes() { reset(); }
+    void reset() { updates = trains = reused_trains = 0; update = features = correlation = detect_fft = psr = match = histogram = scale = 0; }
+};
+
+// Statistics of a correlation response, see KCFTracker::responseStats()
+struct ResponseStats
+{
+    float peak;            // maximum of the response
+    cv::Point2f location;  // position of the peak with sub-pixel refinement, in response pixels
+    cv::Rect sidelobe;     // window around the peak the sidelobe statistics cover...
+    cv::Rect excluded;     // ...without this central part
+    float sidelobe_mean;
+    float sidelobe_std;
+    float psr;             // peak-to-sidelobe ratio, (peak - sidelobe_mean) / sidelobe_std
+    float apce;            // average peak-to-correlation energy, (peak - min)^2 / mean((res - min)^2)
+};
+
+// A cv::Mat whose copies own their data, for the tracker state that is written in place (the model
+// blended with addWeighted, buffers reused from frame to frame): copies of a tracker would share it
+// otherwise. Moves and assignments of other matrices keep the cv::Mat semantics.
+struct OwnedMat : public cv::Mat
+{
+    OwnedMat() {}
+    OwnedMat(const cv::Mat &m) : cv::Mat(m) {}
+    OwnedMat(const OwnedMat &m) : cv::Mat(m.clone()) {}
+    OwnedMat(OwnedMat &&m) { cv::swap(*this, m); }
+    OwnedMat &operator=(const OwnedMat &m) { if (this != &m) cv::Mat::operator=(m.clone()); return *this; }
+    OwnedMat &operator=(OwnedMat &&m) { cv::swap(*this, m); return *this; }
+    using cv::Mat::operator=;
+};
+
+namespace FFTTools { class FFTPlan; }
+
+// Owns the FFT plan of a tracker. Copies start without one, KCFTracker::fft() creates it on first
+// use, so two trackers never share its buffers.
+struct FFTPlanHandle
+{
+    FFTTools::FFTPlan *plan;
+
+    FFTPlanHandle() : plan(NULL) {}
+    FFTPlanHandle(const FFTPlanHandle &) : plan(NULL) {}
+    FFTPlanHandle &operator=(const FFTPlanHandle &) { return *this; }
+    ~FFTPlanHandle() { reset(); }
+    void reset();
+};
+
+// Features of a window (one channel per row) with their spectrum and squared norm, kept from
+// detection to train the model on the same window
+struct FeatureSample
+{
+    OwnedMat x;
+    OwnedMat xf; // stacked packed channel spectra, see KCFTracker::getSpectra()
+    double xx;
+    OwnedMat features; // extraction buffer x points into, taken over by detect() instead of a copy
+};
 
 class KCFTracker : public Tracker
 {
@@ -104,6 +189,26 @@ public:
 	cv::Rect  getRect();
 	cv::Mat getgray(const cv::Mat & image,cv::Rect_<float> roi);
 
+    // Take the detection windows from a per-frame FeaturePyramid built on the frame given to
+    // update() (HOG features without Lab only). NULL goes back to extracting every window.
+    void setFeaturePyramid(const FeaturePyramid *pyramid);
+
+    // Announce the detection windows of the next update() to a pyramid
+    void requireFeatures(FeaturePyramid &pyramid) const;
+
+    // Select the FFT backend of the trackers initialized afterwards by name: "opencv", or "fftw"
+    // when built with USE_FFTW. Returns false if it is not available.
+    static bool setFFTBackend(const std::string &name);
+
+    // Read the frames of update() from a ColorCache: the image given to update() is
+    // cache->image(space), and the regions the tracker reads are converted on demand (HSV ones
+    // for the histogram check). NULL goes back to complete images.
+    void setColorCache(const ColorCache *cache, ColorCache::Space space = ColorCache::GRAY);
+
+    // Hand the intermediate images (features, response, PSR mask, templates) to sink, not owned.
+    // NULL, the default, turns the views off.
+    void setDebugSink(DebugSink *sink);
+
     float interp_factor; // linear interpolation factor for adaptation
     float sigma; // gaussian kernel bandwidth
     float lambda; // regularization
@@ -114,39 +219,110 @@ public:
     int template_size; // template size
     float scale_step; // scale step for multi-scale estimation
     float scale_weight;  // to downweight detection scores of other scales for added stability
+    bool fast_hog; // use the table-driven fhog feature maps
+    bool scale_filter; // DSST-style scale estimation instead of the alternating scale probes
+    int scale_count; // number of scale samples of the scale filter
+    float scale_filter_step; // scale ratio between two scale samples
+    float scale_sigma_factor; // bandwidth of the gaussian label over the scale samples
+    float scale_lr; // learning rate of the scale filter
+    float scale_lambda; // regularization of the scale filter
+    float train_reuse_shift; // train on the detection features when the scale did not change and the target moved at most this many cells (default 0: only when it did not move, negative: never)
+    bool train_shift_features; // move the reused detection features to the new target position (bilinear over cells) instead of training on them as they are
+    float train_reuse_scale; // with train_shift_features, largest relative scale change the reused features are resampled for
+    UpdatePolicy policy; // train, detect only or skip, disabled by default (see updatepolicy.hpp)
+    UpdateDecision last_decision; // decision of the last update() that did not fail
+    MotionModel motion; // predicts the search center, none by default (see motionmodel.hpp); a smaller padding suits it
+    bool collect_timings; // accumulate stage times in timings
+    KCFStageTimes timings;
 	float hist_similarity ;
 	float template_sim;
 	float peak_value;
 	float psr_value;
+	float apce_value; // APCE of the response of the accepted scale
 	int frame_count;
 protected:
-    // Detect object in the current frame.
-	cv::Point2f detect(cv::Mat z, cv::Mat x, float &peak_value, float &psr_value);
+    // Detect object in the current frame, against the model template spectrum _tmplf. Returns the
+    // displacement of the peak from the window center, in cells; stats receives the rest, sample
+    // the features and their spectrum.
+	cv::Point2f detect(cv::Mat x, ResponseStats &stats, FeatureSample &sample);
+
+    // Peak, sidelobe and APCE statistics of a response in two passes over it (the whole response,
+    // then the sidelobe window) and without temporaries.
+    void responseStats(const cv::Mat &res, ResponseStats &stats);
 
     // train tracker with a single image
     void train(cv::Mat x, float train_interp_factor);
+    // Same with the spectrum already computed
+    void train(const FeatureSample &sample, float train_interp_factor);
+
+    // Forward FFT of every feature channel of X, in packed CCS layout. The spectra of all channels
+    // are stacked in one buffer: channel i is rows [i*size_patch[0], (i+1)*size_patch[0]).
+    void getSpectra(const cv::Mat &x, cv::Mat &xf);
 
     // Evaluates a Gaussian kernel with bandwidth SIGMA for all relative shifts between input images X and Y, which must both be MxN. They must    also be periodic (ie., pre-processed with a cosine window).
-    cv::Mat gaussianCorrelation(cv::Mat x1, cv::Mat x2);
+    // The images are given by their stacked channel spectra (see getSpectra) and their squared norms.
+    cv::Mat gaussianCorrelation(const cv::Mat &x1f, double x1sq, const cv::Mat &x2f, double x2sq);
+    // Same for X with itself, from its power spectrum
+    cv::Mat gaussianAutoCorrelation(const cv::Mat &xf, double xsq);
+    // Gaussian kernel from the summed cross-power spectrum xyf of X and Y and |X|^2 + |Y|^2
+    cv::Mat gaussianKernel(const cv::Mat &xyf, double sq);
+
+    // Features of the window centered on target_center at target_scale, resampled from a detection
+    // sample of the window centered on center at feature_scale. Needs at least 3 x 3 cells.
+    void shiftFeatures(const FeatureSample &sample, const cv::Point2f &center, float feature_scale,
+                       const cv::Point2f &target_center, float target_scale, FeatureSample &dst);
 
     // Create Gaussian Peak. Function called only in the first frame.
     cv::Mat createGaussianPeak(int sizey, int sizex);
 
+    // FFT plan of the template size and feature planes, created on first use with
+    // FFTTools::getBackend()
+    FFTTools::FFTPlan &fft();
+
     // Obtain sub-window from image, with replication-padding and extract features
    // cv::Mat getFeatures(const cv::Mat & image, bool inithann, float scale_adjust = 1.0f);
    
 	void getTemplateSize(const cv::Mat & image);
+    // With HOG the result is a view of the tracker's feature planes (one channel per row, already
+    // windowed); it is only valid until the next call.
 	cv::Mat getFeatures(const cv::Mat & image, float scale_adjust);
 
+    // Features of a detection window, from the feature pyramid when one is set and covers the
+    // window, from getFeatures() otherwise. In the first case center and feature_scale are set to
+    // the window actually sampled (its center, and image pixels per template pixel).
+    cv::Mat getDetectionFeatures(const cv::Mat & image, float scale_adjust, cv::Point2f &center, float &feature_scale);
+
+    // Convert the region of the frame a window will read, when the frame comes from a ColorCache
+    void prepareWindow(const cv::Rect_<float> &window) const;
+
     // Initialize Hanning window. Function called only in the first frame.
     void createHanningMats();
 
     // Calculate sub-pixel peak for one dimension
     float subPixelPeak(float left, float center, float right);
 
-    cv::Mat _alphaf;
-    cv::Mat _prob;
-    cv::Mat _tmpl;
+    // Scale filter: a 1-D correlation filter over scale_count samples of the target at scales
+    // scale_filter_step^k around the current size, each resized to _scale_model_sz.
+    void initScaleFilter(const cv::Mat & image);
+    // Spectrum over the scale samples of every feature (one row per feature)
+    void getScaleSpectra(const cv::Mat & image, const cv::Point2f &pos, float width, float height, cv::Mat &xsf);
+    // Relative scale change of the target at pos, whose current size is width x height
+    float detectScale(const cv::Mat & image, const cv::Point2f &pos, float width, float height);
+    void trainScale(const cv::Mat & image, const cv::Point2f &pos, float width, float height, float train_interp_factor);
+
+    // the model is blended in place by train(), a copy of the tracker gets its own
+    OwnedMat _alphaf;
+    OwnedMat _prob;
+    OwnedMat _tmpl;
+    OwnedMat _tmplf; // stacked packed channel spectra of _tmpl, interpolated together with it in train()
+    double _tmpl_sq; // squared norm of _tmpl
+    FeatureSample _samples[2]; // detection at the current scale and at the probed one
+    FeatureSample _train_sample; // spectrum of train(x)
+    // buffers of the kernel correlations, sized in getTemplateSize()
+    OwnedMat _xyf; // (cross-)power spectrum summed over the channels
+    OwnedMat _caux; // cross-power spectrum of one channel
+    OwnedMat _k; // kernel, transformed in place by detect() and train()
+    OwnedMat _quadrant; // scratch quadrant of rearrange()
     //cv::Mat _num;
     //cv::Mat _den;
     cv::Mat _labCentroids;
@@ -154,11 +330,28 @@ protected:
 private:
     int size_patch[3];
     cv::Mat hann;
+    cv::Mat _hann_inv; // 1 / hann, 0 on the border cells where hann is 0
     cv::Size _tmpl_sz;
     float _scale;
     int _gaussian_size;
     bool _hogfeatures;
     bool _labfeatures;
+    FHogWorkspaceHandle _fhog; // fhog buffers and feature planes, sized in getTemplateSize()
+    FFTPlanHandle _fft; // transforms of the template size, see fft()
+    RectTools::SampleTaps _taps; // interpolation taps of the template window
+    const FeaturePyramid *_pyramid; // shared detection features, not owned
+    DebugSink *_debug; // receiver of the intermediate images, not owned
+    const ColorCache *_cache; // lazily converted frame, not owned
+    ColorCache::Space _cache_space; // colour space of the frames given to update()
+    cv::Size _scale_model_sz; // size the scale samples are resized to
+    std::vector<float> _scale_factors; // scale of every sample, relative to the current one
+    cv::Mat _scale_window; // hann weight of every sample
+    cv::Mat _scale_yf; // 1 x scale_count spectrum of the gaussian label
+    cv::Mat _scale_ysf; // _scale_yf repeated for every feature
+    OwnedMat _scale_num; // numerator of the scale filter, one row per feature
+    OwnedMat _scale_den; // denominator, shared by all features
+    FHogWorkspaceHandle _scale_fhog; // fhog buffers of the scale samples
+    std::vector<RectTools::SampleTaps> _scale_taps; // interpolation taps of every scale sample
 	cv::Mat tmpl_original;	
 	histogram ref_histos;
 	histogram histos;
@@ -0,0 +1,128 @@
+#include "matpool.hpp"
+#include <opencv2/core/types_c.h>
+
+using namespace std;
+using namespace cv;
+
+MatPool::MatPool(size_t max_cached)
+    : _max_cached(max_cached)
+{
+    _stats.hits = 0;
+    _stats.misses = 0;
+    _stats.cached_bytes = 0;
+}
+
+MatPool::~MatPool()
+{
+    trim();
+}
+
+MatPool &MatPool::instance()
+{
+    static MatPool *pool = new MatPool();
+    return *pool;
+}
+
+void MatPool::install(MatPool *pool)
+{
+    cv::Mat::setDefaultAllocator(pool);
+}
+
+MatPool::Stats MatPool::stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void MatPool::trim()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (std::map<size_t, vector<void *> >::iterator it = _free.begin(); it != _free.end(); ++it)
+    {
+        for (size_t i = 0; i < it->second.size(); i++)
+            cv::fastFree(it->second[i]);
+    }
+    _free.clear();
+    _stats.cached_bytes = 0;
+}
+
+void *MatPool::take(size_t bytes) const
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::map<size_t, vector<void *> >::iterator it = _free.find(bytes);
+        if (it != _free.end() && !it->second.empty())
+        {
+            void *buffer = it->second.back();
+            it->second.pop_back();
+            _stats.hits++;
+            _stats.cached_bytes -= bytes;
+            return buffer;
+        }
+        _stats.misses++;
+    }
+    return cv::fastMalloc(bytes);
+}
+
+void MatPool::give(void *buffer, size_t bytes) const
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stats.cached_bytes + bytes <= _max_cached)
+        {
+            _free[bytes].push_back(buffer);
+            _stats.cached_bytes += bytes;
+            return;
+        }
+    }
+    cv::fastFree(buffer);
+}
+
+// Same layout as OpenCV's default allocator, only the buffer comes from the pool
+cv::UMatData *MatPool::allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+                                MatPoolAccessFlag, cv::UMatUsageFlags) const
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--)
+    {
+        if (step)
+        {
+            if (data0 && step[i] != CV_AUTOSTEP)
+            {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            }
+            else
+            {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    cv::UMatData *u = new cv::UMatData(this);
+    u->data = u->origdata = data0 ? (uchar *)data0 : (uchar *)take(total);
+    u->size = total;
+    if (data0)
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    return u;
+}
+
+bool MatPool::allocate(cv::UMatData *u, MatPoolAccessFlag, cv::UMatUsageFlags) const
+{
+    return u != NULL;
+}
+
+void MatPool::deallocate(cv::UMatData *u) const
+{
+    if (!u)
+        return;
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+    {
+        give(u->origdata, u->size);
+        u->origdata = 0;
+    }
+    delete u;
+}
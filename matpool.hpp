@@ -0,0 +1,90 @@
+/*
+
+Recycling allocator for cv::Mat buffers.
+
+Frames, windows, feature planes, spectra and kernels have the same few sizes
+from one frame to the next, yet every cvtColor, resize, dft or arithmetic
+expression allocates its output and frees it again. MatPool is a
+cv::MatAllocator that keeps the freed buffers, grouped by their size in bytes,
+and hands them out again for the next Mat of the same size and type. Buffers are
+aligned like cv::fastMalloc.
+
+A Mat created through the pool returns its buffer to it when its last reference
+goes away, nothing has to be released by hand. The simplest use is to install a
+pool as OpenCV's default allocator at startup, then every Mat allocated
+afterwards, by OpenCV or by the tracker, draws from it:
+
+    MatPool::install(&MatPool::instance());
+
+A single Mat can also be tied to a pool before it is created:
+
+    cv::Mat m;
+    m.allocator = &pool;
+    cv::cvtColor(frame, m, cv::COLOR_BGR2GRAY);   // m's buffer comes from the pool
+
+The pool is thread safe. At most max_cached bytes are kept; buffers freed
+beyond that go back to the system. A pool must outlive every Mat allocated from
+it, so instance() is never destroyed.
+
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifndef _MATPOOL_HPP_
+#define _MATPOOL_HPP_
+#endif
+
+// OpenCV 4 turned the access flags of MatAllocator into an enum
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag MatPoolAccessFlag;
+#else
+typedef int MatPoolAccessFlag;
+#endif
+
+class MatPool : public cv::MatAllocator
+{
+public:
+    struct Stats
+    {
+        size_t hits;         // allocations served from the pool
+        size_t misses;       // allocations that went to the system
+        size_t cached_bytes; // bytes kept for reuse
+    };
+
+    explicit MatPool(size_t max_cached = 256 << 20);
+    ~MatPool();
+
+    // Process-wide pool, never destroyed
+    static MatPool &instance();
+
+    // Make pool the allocator of all Mats created afterwards, NULL goes back to OpenCV's own
+    static void install(MatPool *pool);
+
+    Stats stats() const;
+
+    // Return all cached buffers to the system
+    void trim();
+
+    // cv::MatAllocator
+    virtual cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                                   MatPoolAccessFlag flags, cv::UMatUsageFlags usageFlags) const;
+    virtual bool allocate(cv::UMatData *data, MatPoolAccessFlag accessflags, cv::UMatUsageFlags usageFlags) const;
+    virtual void deallocate(cv::UMatData *data) const;
+
+private:
+    MatPool(const MatPool &);
+    MatPool &operator=(const MatPool &);
+
+    void *take(size_t bytes) const;
+    void give(void *buffer, size_t bytes) const;
+
+    size_t _max_cached;
+    mutable std::mutex _mutex;
+    mutable std::map<size_t, std::vector<void *> > _free; // free buffers by size in bytes
+    mutable Stats _stats;
+};
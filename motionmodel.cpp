@@ -0,0 +1,97 @@
+#include "motionmodel.hpp"
+
+MotionModel::MotionModel()
+    : type(MOTION_NONE), velocity_smoothing(0.5f), process_noise(1.0f), measurement_noise(2.0f)
+{
+    reset(cv::Point2f(0, 0));
+}
+
+void MotionModel::reset(const cv::Point2f &center)
+{
+    reset(_x, center.x);
+    reset(_y, center.y);
+}
+
+void MotionModel::reset(Axis &axis, float position) const
+{
+    axis.p = position;
+    axis.v = 0;
+    // the position is a detection, the velocity is unknown
+    axis.p00 = measurement_noise * measurement_noise;
+    axis.p01 = 0;
+    axis.p11 = 100.0f;
+}
+
+cv::Point2f MotionModel::predict() const
+{
+    if (type == MOTION_NONE)
+        return cv::Point2f(_x.p, _y.p);
+    return cv::Point2f(_x.p + _x.v, _y.p + _y.v);
+}
+
+void MotionModel::predict(Axis &axis) const
+{
+    // x' = F x with F = [1 1; 0 1], P' = F P F^T + Q with the white noise acceleration Q
+    float q = process_noise * process_noise;
+    float p00 = axis.p00 + 2 * axis.p01 + axis.p11 + 0.25f * q;
+    float p01 = axis.p01 + axis.p11 + 0.5f * q;
+    float p11 = axis.p11 + q;
+    axis.p += axis.v;
+    axis.p00 = p00;
+    axis.p01 = p01;
+    axis.p11 = p11;
+}
+
+void MotionModel::correct(Axis &axis, float position) const
+{
+    predict(axis);
+    // measurement of the position only, H = [1 0]
+    float s = axis.p00 + measurement_noise * measurement_noise;
+    float k0 = axis.p00 / s;
+    float k1 = axis.p01 / s;
+    float innovation = position - axis.p;
+    axis.p += k0 * innovation;
+    axis.v += k1 * innovation;
+    float p00 = (1 - k0) * axis.p00;
+    float p01 = (1 - k0) * axis.p01;
+    float p11 = axis.p11 - k1 * axis.p01;
+    axis.p00 = p00;
+    axis.p01 = p01;
+    axis.p11 = p11;
+}
+
+void MotionModel::correct(const cv::Point2f &center)
+{
+    if (type == MOTION_KALMAN)
+    {
+        correct(_x, center.x);
+        correct(_y, center.y);
+        return;
+    }
+    if (type == MOTION_CONSTANT_VELOCITY)
+    {
+        _x.v += velocity_smoothing * ((center.x - _x.p) - _x.v);
+        _y.v += velocity_smoothing * ((center.y - _y.p) - _y.v);
+    }
+    _x.p = center.x;
+    _y.p = center.y;
+}
+
+void MotionModel::coast()
+{
+    if (type == MOTION_KALMAN)
+    {
+        predict(_x);
+        predict(_y);
+    }
+    else
+    {
+        _x.p += _x.v;
+        _y.p += _y.v;
+    }
+}
+
+cv::Point2f MotionModel::velocity() const
+{
+    return cv::Point2f(_x.v, _y.v);
+}
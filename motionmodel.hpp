@@ -0,0 +1,80 @@
+/*
+
+Motion prior for the search window of a KCFTracker.
+
+Without it, update() searches around the previous position of the target, so a
+target moving more than the padding allows per frame (fast camera motion) leaves
+the window and is lost. A MotionModel predicts the position of the target in the
+next frame from its past positions, and the tracker centres its search on the
+prediction instead:
+
+    MOTION_NONE               previous position (default)
+    MOTION_CONSTANT_VELOCITY  previous position plus the velocity, smoothed over
+                              the last displacements with velocity_smoothing
+    MOTION_KALMAN             constant velocity Kalman filter per axis, white
+                              noise acceleration of process_noise pixels/frame^2,
+                              detections with measurement_noise pixels of error
+
+A frame without detection (rejected, or skipped by the update policy) coasts:
+the model moves on by its velocity. Each axis is filtered on its own, so no
+matrix library is needed.
+
+Since the detection only has to cover the error of the prediction instead of the
+whole motion, a tracker with a motion model can be initialized with a smaller
+padding: smaller windows, smaller FFTs.
+
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+#ifndef _MOTIONMODEL_HPP_
+#define _MOTIONMODEL_HPP_
+#endif
+
+enum MotionModelType
+{
+    MOTION_NONE = 0,
+    MOTION_CONSTANT_VELOCITY,
+    MOTION_KALMAN
+};
+
+class MotionModel
+{
+public:
+    MotionModel();
+
+    MotionModelType type;
+    float velocity_smoothing; // constant velocity: weight of the last displacement in the velocity
+    float process_noise;      // Kalman: acceleration noise, pixels/frame^2
+    float measurement_noise;  // Kalman: error of a detected position, pixels
+
+    // Start from a target at rest at center
+    void reset(const cv::Point2f &center);
+
+    // Expected center of the target in the next frame
+    cv::Point2f predict() const;
+
+    // Detected center of the target in the new frame
+    void correct(const cv::Point2f &center);
+
+    // New frame without detection, the target moves on as predicted
+    void coast();
+
+    // Current velocity estimate, pixels/frame
+    cv::Point2f velocity() const;
+
+private:
+    struct Axis
+    {
+        float p, v;            // position and velocity
+        float p00, p01, p11;   // covariance, symmetric
+    };
+
+    void reset(Axis &axis, float position) const;
+    void predict(Axis &axis) const;
+    void correct(Axis &axis, float position) const;
+
+    Axis _x, _y;
+};
@@ -0,0 +1,209 @@
+#include "multikcftracker.hpp"
+#include "trace.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+// Updates the targets of one stripe. Every target only writes its own slot of the
+// result vector, so no synchronisation is needed between stripes.
+class UpdateTargetsBody : public cv::ParallelLoopBody
+{
+public:
+    UpdateTargetsBody(const cv::Mat &image, vector<KCFTracker> &trackers, vector<TargetResult> &results)
+        : _image(image), _trackers(trackers), _results(results)
+    {
+    }
+
+    virtual void operator()(const cv::Range &range) const
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            KCF_TRACE_SCOPE_ID("target", i);
+            KCFTracker &tracker = _trackers[i];
+            TargetResult &res = _results[i];
+            bool tracked = tracker.update(_image);
+            res.status = tracked ? TARGET_TRACKING : TARGET_LOST;
+            res.rect = tracker.getRect();
+            res.peak_value = tracker.peak_value;
+            res.psr_value = tracker.psr_value;
+            res.apce_value = tracker.apce_value;
+            res.decision = tracker.last_decision;
+            KCF_TRACE_COUNTER("peak", i, res.peak_value);
+            KCF_TRACE_COUNTER("psr", i, res.psr_value);
+            KCF_TRACE_COUNTER("apce", i, res.apce_value);
+        }
+    }
+
+private:
+    const cv::Mat &_image;
+    vector<KCFTracker> &_trackers;
+    vector<TargetResult> &_results;
+};
+}
+
+MultiKCFTracker::MultiKCFTracker(bool hog, bool fixed_window, bool multiscale, bool lab)
+    : _hog(hog), _fixed_window(fixed_window), _multiscale(multiscale), _lab(lab), _shared_features(false), _scale_filter(false), _debug(NULL),
+      _template_size(-1), _collect_timings(false), _motion(MOTION_NONE), _padding(-1)
+{
+}
+
+int MultiKCFTracker::add(const cv::Rect &roi, cv::Mat image)
+{
+    _trackers.push_back(KCFTracker(_hog, _fixed_window, _multiscale, _lab));
+    _trackers.back().scale_filter = _scale_filter;
+    _trackers.back().setDebugSink(_debug);
+    _trackers.back().collect_timings = _collect_timings;
+    _trackers.back().policy.params = _policy;
+    _trackers.back().motion.type = _motion;
+    if (_padding > 0)
+        _trackers.back().padding = _padding;
+    if (_template_size >= 0)
+        _trackers.back().template_size = _template_size;
+    if (!_trackers.back().init(roi, image))
+    {
+        _trackers.pop_back();
+        return -1;
+    }
+
+    TargetResult res;
+    res.rect = roi;
+    res.status = TARGET_UNINITIALIZED;
+    res.peak_value = 0;
+    res.psr_value = 0;
+    res.apce_value = 0;
+    res.decision = UPDATE_TRAIN;
+    _results.push_back(res);
+    return (int)_trackers.size() - 1;
+}
+
+void MultiKCFTracker::update(cv::Mat image)
+{
+    updateTargets(image, NULL, ColorCache::GRAY);
+}
+
+void MultiKCFTracker::update(const ColorCache &cache, ColorCache::Space space)
+{
+    updateTargets(cache.image(space), &cache, space);
+}
+
+void MultiKCFTracker::updateTargets(const cv::Mat &image, const ColorCache *cache, ColorCache::Space space)
+{
+    if (_trackers.empty())
+        return;
+    KCF_TRACE_SCOPE("MultiKCFTracker::update");
+
+    // the pyramid is built before the parallel section and only read inside it
+    const FeaturePyramid *pyramid = NULL;
+    if (_shared_features)
+    {
+        _pyramid.reset(_trackers[0].cell_size, _trackers[0].scale_step);
+        for (size_t i = 0; i < _trackers.size(); i++)
+            _trackers[i].requireFeatures(_pyramid);
+        _pyramid.build(image, cache, space);
+        pyramid = &_pyramid;
+    }
+    for (size_t i = 0; i < _trackers.size(); i++)
+    {
+        _trackers[i].setFeaturePyramid(pyramid);
+        _trackers[i].setColorCache(cache, space);
+    }
+
+    // one stripe per target: targets are coarse grained and their cost is similar
+    cv::parallel_for_(cv::Range(0, (int)_trackers.size()),
+                      UpdateTargetsBody(image, _trackers, _results),
+                      (double)_trackers.size());
+
+    for (size_t i = 0; i < _trackers.size(); i++)
+    {
+        _trackers[i].setFeaturePyramid(NULL);
+        _trackers[i].setColorCache(NULL);
+    }
+}
+
+void MultiKCFTracker::setSharedFeatures(bool enable)
+{
+    _shared_features = enable;
+}
+
+void MultiKCFTracker::setScaleFilter(bool enable)
+{
+    _scale_filter = enable;
+}
+
+void MultiKCFTracker::setDebugSink(DebugSink *sink)
+{
+    _debug = sink;
+    for (size_t i = 0; i < _trackers.size(); i++)
+        _trackers[i].setDebugSink(sink);
+}
+
+void MultiKCFTracker::setTemplateSize(int size)
+{
+    _template_size = size;
+}
+
+void MultiKCFTracker::setMotionModel(MotionModelType type, float padding)
+{
+    _motion = type;
+    _padding = padding;
+}
+
+void MultiKCFTracker::setUpdatePolicy(const UpdatePolicyParams &params)
+{
+    _policy = params;
+    for (size_t i = 0; i < _trackers.size(); i++)
+        _trackers[i].policy.params = params;
+}
+
+void MultiKCFTracker::setCollectTimings(bool enable)
+{
+    _collect_timings = enable;
+    for (size_t i = 0; i < _trackers.size(); i++)
+        _trackers[i].collect_timings = enable;
+}
+
+void MultiKCFTracker::removeLost()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < _trackers.size(); i++)
+    {
+        if (_results[i].status == TARGET_LOST)
+            continue;
+        if (kept != i)
+        {
+            _trackers[kept] = _trackers[i];
+            _results[kept] = _results[i];
+        }
+        kept++;
+    }
+    _trackers.erase(_trackers.begin() + kept, _trackers.end());
+    _results.erase(_results.begin() + kept, _results.end());
+}
+
+void MultiKCFTracker::clear()
+{
+    _trackers.clear();
+    _results.clear();
+}
+
+int MultiKCFTracker::size() const
+{
+    return (int)_trackers.size();
+}
+
+const TargetResult &MultiKCFTracker::result(int i) const
+{
+    return _results[i];
+}
+
+const std::vector<TargetResult> &MultiKCFTracker::results() const
+{
+    return _results;
+}
+
+KCFTracker &MultiKCFTracker::tracker(int i)
+{
+    return _trackers[i];
+}
@@ -0,0 +1,136 @@
+/*
+
+Multi-target front end for KCFTracker.
+
+All targets are updated on the same frame. The per-target work (detection at the
+scale probes, template matching, histogram check and training) does not touch any
+other target, so update() spreads it over OpenCV's worker thread pool with
+cv::parallel_for_. The number of threads follows cv::setNumThreads().
+
+Results are stored by target index, so their order never depends on thread
+scheduling: result(i) always belongs to the i-th added target.
+
+Usage:
+    MultiKCFTracker trackers(HOG, FIXEDWINDOW, MULTISCALE, LAB);
+    trackers.add(roi, frame);           // once per target
+    trackers.update(frame);             // every frame
+    trackers.result(i).status / .rect
+    trackers.removeLost();              // optional, drops lost targets keeping order
+
+With setSharedFeatures(true) and HOG features, update() first builds one
+FeaturePyramid over the search windows of all targets and every target takes
+its detection windows from it (see featurepyramid.hpp). Feature cost then
+follows the area covered by the targets instead of targets x scales, at the
+price of windows snapped to the cell grid of the pyramid levels.
+
+setUpdatePolicy() lets every target decide on its own whether a frame trains
+its model, only detects, or skips the detection (see updatepolicy.hpp); stable
+targets then cost less and the work goes to the ones that move.
+
+update(cache, space) tracks on a frame wrapped in a ColorCache instead of a
+converted image: targets, and the pyramid, convert only the tiles under their
+windows, on the worker threads (see colorcache.hpp).
+
+setDebugSink() attaches one DebugSink to every target. Targets call it from the
+worker threads, so the sink must be thread-safe (see debugsink.hpp).
+
+ */
+
+#pragma once
+
+#include "kcftracker.hpp"
+#include <vector>
+
+#ifndef _MULTIKCFTRACKER_HPP_
+#define _MULTIKCFTRACKER_HPP_
+#endif
+
+enum TargetStatus
+{
+    TARGET_UNINITIALIZED = 0, // added but never updated
+    TARGET_TRACKING,          // last update() accepted the detection
+    TARGET_LOST               // last update() rejected the detection
+};
+
+struct TargetResult
+{
+    cv::Rect rect;       // tracker position after the last update
+    TargetStatus status;
+    float peak_value;    // response peak of the accepted scale
+    float psr_value;     // peak-to-sidelobe ratio of the accepted scale
+    float apce_value;    // average peak-to-correlation energy of the accepted scale
+    UpdateDecision decision; // what the last update did with the target, see updatepolicy.hpp
+};
+
+class MultiKCFTracker
+{
+public:
+    // Constructor, parameters are forwarded to every KCFTracker created by add()
+    MultiKCFTracker(bool hog = true, bool fixed_window = true, bool multiscale = true, bool lab = true);
+
+    // Initialize a new target. Returns its index, or -1 if KCFTracker::init() refused the roi.
+    int add(const cv::Rect &roi, cv::Mat image);
+
+    // Update all targets on the new frame, in parallel
+    void update(cv::Mat image);
+
+    // Same on the frame of cache, converting the regions the targets read to space on demand
+    void update(const ColorCache &cache, ColorCache::Space space = ColorCache::GRAY);
+
+    // Drop the targets whose last update failed. Remaining targets keep their relative order.
+    void removeLost();
+
+    // Share one per-frame feature pyramid between all targets for detection (off by default)
+    void setSharedFeatures(bool enable);
+
+    // Estimate scale with KCFTracker's 1-D scale filter instead of the alternating scale probes.
+    // Applies to the targets added afterwards.
+    void setScaleFilter(bool enable);
+
+    // Receiver of the intermediate images of all targets, current and future. NULL turns it off.
+    void setDebugSink(DebugSink *sink);
+
+    // Template size of the targets added afterwards, see KCFTracker::template_size. Negative
+    // keeps the KCFTracker default.
+    void setTemplateSize(int size);
+
+    // Motion prior of the targets added afterwards (see motionmodel.hpp). A positive padding
+    // replaces KCFTracker::padding for them: centred on the prediction, the search window only
+    // has to cover its error.
+    void setMotionModel(MotionModelType type, float padding = -1);
+
+    // Update policy of all targets, current and future. Every target keeps its own state and
+    // decision counters (tracker(i).policy.decisions()).
+    void setUpdatePolicy(const UpdatePolicyParams &params);
+
+    // Accumulate the stage times of all targets, current and future, in KCFTracker::timings
+    void setCollectTimings(bool enable);
+
+    void clear();
+    int size() const;
+
+    const TargetResult &result(int i) const;
+    const std::vector<TargetResult> &results() const;
+
+    // Direct access, e.g. to tune parameters of a single target
+    KCFTracker &tracker(int i);
+
+private:
+    void updateTargets(const cv::Mat &image, const ColorCache *cache, ColorCache::Space space);
+
+    bool _hog;
+    bool _fixed_window;
+    bool _multiscale;
+    bool _lab;
+    bool _shared_features;
+    bool _scale_filter;
+    DebugSink *_debug;
+    int _template_size;
+    bool _collect_timings;
+    UpdatePolicyParams _policy;
+    MotionModelType _motion;
+    float _padding;
+    FeaturePyramid _pyramid;
+    std::vector<KCFTracker> _trackers;
+    std::vector<TargetResult> _results;
+};
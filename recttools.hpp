@@ -37,6 +37,7 @@ the use of this software, even if advised of the possibility of such damage.
 
 //#include <cv.h>
 #include <math.h>
+#include <vector>
 
 #ifndef _OPENCV_RECTTOOLS_HPP_
 #define _OPENCV_RECTTOOLS_HPP_
@@ -129,11 +130,116 @@ inline cv::Mat subwindow(const cv::Mat &in, const cv::Rect & window, int borderT
 
 inline cv::Mat getGrayImage(cv::Mat img)
 {
-  //  cv::cvtColor(img, img, CV_BGR2GRAY);
+  //  cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
     img.convertTo(img, CV_32F, 1 / 255.f);
     return img;
 }
 
+// Bilinear taps of every output column (or row) of sampleWindow: source indices are clamped to
+// the image, which replicates its border
+inline void sampleTaps(float start, float step, int outLen, int inLen, std::vector<int> &i0, std::vector<int> &i1, std::vector<float> &frac)
+{
+    i0.resize(outLen);
+    i1.resize(outLen);
+    frac.resize(outLen);
+    for (int i = 0; i < outLen; i++)
+    {
+        float s = start + (i + 0.5f) * step - 0.5f;
+        int k = cvFloor(s);
+        float f = s - k;
+        int k1 = k + 1;
+        if (k < 0) { k = 0; if (k1 < 0) k1 = 0; }
+        if (k1 > inLen - 1) { k1 = inLen - 1; if (k > inLen - 1) k = inLen - 1; }
+        i0[i] = k;
+        i1[i] = k1;
+        frac[i] = f;
+    }
+}
+
+template <typename Tin, typename Tout>
+inline void sampleWindowRows(const cv::Mat &in, const std::vector<int> &x0, const std::vector<int> &x1, const std::vector<float> &fx,
+                             const std::vector<int> &y0, const std::vector<int> &y1, const std::vector<float> &fy,
+                             cv::Mat &dst, float alpha, float beta)
+{
+    const int cn = in.channels();
+    for (int y = 0; y < dst.rows; y++)
+    {
+        const Tin *r0 = in.ptr<Tin>(y0[y]);
+        const Tin *r1 = in.ptr<Tin>(y1[y]);
+        Tout *out = dst.ptr<Tout>(y);
+        float wy = fy[y];
+        for (int x = 0; x < dst.cols; x++)
+        {
+            const Tin *a = r0 + x0[x] * cn, *b = r0 + x1[x] * cn;
+            const Tin *c = r1 + x0[x] * cn, *d = r1 + x1[x] * cn;
+            float wx = fx[x];
+            for (int ch = 0; ch < cn; ch++)
+            {
+                float top = a[ch] + wx * (b[ch] - a[ch]);
+                float bottom = c[ch] + wx * (d[ch] - c[ch]);
+                out[x * cn + ch] = cv::saturate_cast<Tout>((top + wy * (bottom - top)) * alpha + beta);
+            }
+        }
+    }
+}
+
+// Taps of a sampleWindow call, kept by the caller from frame to frame. They are only computed
+// again when the window, the output size or the image size change, and their buffers are only
+// reallocated when the output grows.
+struct SampleTaps
+{
+    std::vector<int> x0, x1, y0, y1;
+    std::vector<float> fx, fy;
+    cv::Rect_<float> window;
+    cv::Size size, image;
+
+    SampleTaps() : window(0, 0, -1, -1) {}
+
+    void prepare(const cv::Rect_<float> &w, const cv::Size &s, const cv::Size &img)
+    {
+        if (w == window && s == size && img == image)
+            return;
+        sampleTaps(w.x, w.width / s.width, s.width, img.width, x0, x1, fx);
+        sampleTaps(w.y, w.height / s.height, s.height, img.height, y0, y1, fy);
+        window = w;
+        size = s;
+        image = img;
+    }
+};
+
+// Samples the window of in (which may extend past the image, its border is replicated) at size
+// with bilinear interpolation, and writes alpha * value + beta into dst, in depth ddepth (-1 keeps
+// the depth of in). Replaces subwindow + cv::resize + convertTo in one pass; dst is only
+// reallocated if its size or type differ. Supports 8-bit and float images, any number of channels.
+inline void sampleWindow(const cv::Mat &in, const cv::Rect_<float> &window, const cv::Size &size, cv::Mat &dst,
+                         SampleTaps &taps, int ddepth = -1, float alpha = 1, float beta = 0)
+{
+    assert(window.width > 0 && window.height > 0 && !in.empty());
+    assert(in.depth() == CV_8U || in.depth() == CV_32F);
+    if (ddepth < 0) ddepth = in.depth();
+    dst.create(size, CV_MAKETYPE(ddepth, in.channels()));
+    taps.prepare(window, size, in.size());
+
+    const SampleTaps &t = taps;
+    if (in.depth() == CV_8U)
+    {
+        if (ddepth == CV_8U) sampleWindowRows<uchar, uchar>(in, t.x0, t.x1, t.fx, t.y0, t.y1, t.fy, dst, alpha, beta);
+        else sampleWindowRows<uchar, float>(in, t.x0, t.x1, t.fx, t.y0, t.y1, t.fy, dst, alpha, beta);
+    }
+    else
+    {
+        if (ddepth == CV_8U) sampleWindowRows<float, uchar>(in, t.x0, t.x1, t.fx, t.y0, t.y1, t.fy, dst, alpha, beta);
+        else sampleWindowRows<float, float>(in, t.x0, t.x1, t.fx, t.y0, t.y1, t.fy, dst, alpha, beta);
+    }
+}
+
+// Same, with taps computed for this call only
+inline void sampleWindow(const cv::Mat &in, const cv::Rect_<float> &window, const cv::Size &size, cv::Mat &dst,
+                         int ddepth = -1, float alpha = 1, float beta = 0)
+{
+    SampleTaps taps;
+    sampleWindow(in, window, size, dst, taps, ddepth, alpha, beta);
+}
 }
 
 
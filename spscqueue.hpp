@@ -0,0 +1,102 @@
+/*
+
+Bounded single-producer single-consumer queue.
+
+One thread pushes, one thread pops, neither takes a lock: the producer only
+writes _head, the consumer only writes _tail. Items come out in the order they
+went in. push() waits while the queue is full, which is the backpressure of a
+pipeline built from these queues: a slow stage stalls the stages before it
+instead of letting frames pile up. pop() waits while the queue is empty and
+returns false once the producer has called close() and everything was popped.
+
+Waiting spins briefly, then yields, then sleeps, so an idle stage does not keep
+a core busy.
+
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _SPSCQUEUE_HPP_
+#define _SPSCQUEUE_HPP_
+#endif
+
+template <typename T>
+class SPSCQueue
+{
+public:
+    // Holds up to capacity items
+    explicit SPSCQueue(size_t capacity)
+        : _items(capacity + 1), _head(0), _tail(0), _closed(false)
+    {
+    }
+
+    bool tryPush(T &item)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        size_t next = head + 1 == _items.size() ? 0 : head + 1;
+        if (next == _tail.load(std::memory_order_acquire))
+            return false;
+        _items[head] = std::move(item);
+        _head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &item)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+        item = std::move(_items[tail]);
+        _items[tail] = T(); // do not keep a reference to the item's buffers
+        _tail.store(tail + 1 == _items.size() ? 0 : tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer: waits for room
+    void push(T item)
+    {
+        for (int spins = 0; !tryPush(item); spins++)
+            wait(spins);
+    }
+
+    // Consumer: waits for an item, false at the end of the stream
+    bool pop(T &item)
+    {
+        for (int spins = 0; !tryPop(item); spins++)
+        {
+            // everything pushed before close() is visible once closed is
+            if (_closed.load(std::memory_order_acquire))
+                return tryPop(item);
+            wait(spins);
+        }
+        return true;
+    }
+
+    // Producer: no more items
+    void close()
+    {
+        _closed.store(true, std::memory_order_release);
+    }
+
+private:
+    static void wait(int spins)
+    {
+        if (spins < 64)
+            return;
+        if (spins < 256)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    std::vector<T> _items; // one slot stays free to tell full from empty
+    alignas(64) std::atomic<size_t> _head; // next slot to write, own cache line
+    alignas(64) std::atomic<size_t> _tail; // next slot to read
+    std::atomic<bool> _closed;
+};
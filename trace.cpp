@@ -0,0 +1,172 @@
+#include "trace.hpp"
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace Trace
+{
+std::atomic<bool> g_enabled(false);
+
+namespace
+{
+const unsigned CAPACITY = 1 << 16; // events per thread, a power of 2 (2.5 MB)
+
+struct Event
+{
+    const char *name;
+    int id;
+    bool counter;
+    int64 start;
+    int64 end;
+    double value;
+};
+
+// Written by its thread only, read by the drain. head and tail only grow, the slot of an event is
+// its index modulo CAPACITY.
+struct ThreadBuffer
+{
+    Event events[CAPACITY];
+    std::atomic<unsigned> head; // next event to write
+    std::atomic<unsigned> tail; // next event to drain
+    int tid;
+
+    explicit ThreadBuffer(int t) : head(0), tail(0), tid(t) {}
+};
+
+// Buffers of all threads that ever recorded. They are never freed: a worker thread may exit while
+// its events are still to be drained.
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<ThreadBuffer *> buffers;
+    std::atomic<long long> dropped;
+    int64 origin;
+
+    Registry() : dropped(0), origin(cv::getTickCount()) {}
+};
+
+Registry &registry()
+{
+    static Registry *r = new Registry();
+    return *r;
+}
+
+thread_local ThreadBuffer *t_buffer = NULL;
+
+ThreadBuffer *threadBuffer()
+{
+    if (t_buffer == NULL)
+    {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        t_buffer = new ThreadBuffer((int)r.buffers.size() + 1);
+        r.buffers.push_back(t_buffer);
+    }
+    return t_buffer;
+}
+
+void push(const Event &e)
+{
+    ThreadBuffer *b = threadBuffer();
+    unsigned head = b->head.load(std::memory_order_relaxed);
+    if (head - b->tail.load(std::memory_order_acquire) >= CAPACITY)
+    {
+        registry().dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    b->events[head & (CAPACITY - 1)] = e;
+    b->head.store(head + 1, std::memory_order_release);
+}
+
+double microseconds(int64 ticks)
+{
+    return ticks * 1e6 / cv::getTickFrequency();
+}
+}
+
+void setEnabled(bool enable)
+{
+    registry(); // the time origin is set before the first event
+    g_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void record(const char *name, int id, int64 start, int64 end)
+{
+    Event e;
+    e.name = name;
+    e.id = id;
+    e.counter = false;
+    e.start = start;
+    e.end = end;
+    e.value = 0;
+    push(e);
+}
+
+void counter(const char *name, int id, double value)
+{
+    Event e;
+    e.name = name;
+    e.id = id;
+    e.counter = true;
+    e.start = e.end = cv::getTickCount();
+    e.value = value;
+    push(e);
+}
+
+void writeChromeTrace(std::ostream &out)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    std::streamsize precision = out.precision(3);
+    std::ios::fmtflags flags = out.setf(std::ios::fixed, std::ios::floatfield);
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (size_t i = 0; i < r.buffers.size(); i++)
+    {
+        ThreadBuffer *b = r.buffers[i];
+        unsigned head = b->head.load(std::memory_order_acquire);
+        unsigned tail = b->tail.load(std::memory_order_relaxed);
+        for (; tail != head; tail++)
+        {
+            const Event &e = b->events[tail & (CAPACITY - 1)];
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\": \"" << e.name;
+            if (e.counter && e.id >= 0)
+                out << "[" << e.id << "]";
+            out << "\", \"pid\": 1, \"tid\": " << b->tid << ", \"ts\": " << microseconds(e.start - r.origin);
+            if (e.counter)
+            {
+                out << ", \"ph\": \"C\", \"args\": {\"value\": " << e.value << "}}";
+                continue;
+            }
+            out << ", \"ph\": \"X\", \"dur\": " << microseconds(e.end - e.start);
+            if (e.id >= 0)
+                out << ", \"args\": {\"id\": " << e.id << "}";
+            out << "}";
+        }
+        b->tail.store(head, std::memory_order_release);
+    }
+    out << "\n]}\n";
+
+    out.precision(precision);
+    out.flags(flags);
+}
+
+bool writeChromeTrace(const char *path)
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+    writeChromeTrace(out);
+    return out.good();
+}
+
+long long dropped()
+{
+    return registry().dropped.load(std::memory_order_relaxed);
+}
+}
@@ -0,0 +1,102 @@
+/*
+
+Hot path instrumentation: scoped timers and counters, written to Chrome trace JSON.
+
+    KCF_TRACE_SCOPE("detect");                  // time of the enclosing scope
+    KCF_TRACE_SCOPE_ID("target", i);            // same, tagged with a target id
+    KCF_TRACE_COUNTER("psr", i, psr_value);     // value of counter psr of target i
+
+    Trace::setEnabled(true);                    // off by default
+    ...
+    Trace::writeChromeTrace("kcf.trace.json");  // open in chrome://tracing or ui.perfetto.dev
+
+Every thread records into its own ring buffer (single producer, single consumer),
+so recording never takes a lock and never waits for the writer. When a buffer is
+full, new events are dropped and counted rather than overwriting events that may
+be being read. writeChromeTrace() drains the buffers of all threads and may be
+called while they are recording; it returns the events recorded since the
+previous call.
+
+The macros only exist when KCF_TRACE is defined (the CMake build defines it,
+option KCF_TRACE). Otherwise they expand to nothing. When compiled in but
+disabled at runtime, a scope costs two well predicted branches and no clock
+read: the constructor loads the global flag once and keeps it in the scope,
+the destructor tests that copy, so a scope records either both ends or none
+even if tracing is switched in between.
+
+Names must be string literals or otherwise outlive the trace, they are stored
+as pointers and written without escaping.
+
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <atomic>
+#include <ostream>
+
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+#endif
+
+namespace Trace
+{
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+// Start or stop recording, for all threads
+void setEnabled(bool enable);
+
+// Record a complete event, start and end in cv::getTickCount() ticks. id < 0 for none.
+void record(const char *name, int id, int64 start, int64 end);
+
+// Record the value of a counter. Counters with the same name and different ids are separate tracks.
+void counter(const char *name, int id, double value);
+
+// Write the events recorded since the previous drain as Chrome trace JSON
+void writeChromeTrace(std::ostream &out);
+bool writeChromeTrace(const char *path);
+
+// Events dropped because a thread's ring buffer was full, since the start
+long long dropped();
+
+class Scope
+{
+public:
+    explicit Scope(const char *name, int id = -1)
+        : _name(name), _id(id), _on(enabled()), _start(_on ? cv::getTickCount() : 0)
+    {
+    }
+
+    ~Scope()
+    {
+        if (_on)
+            record(_name, _id, _start, cv::getTickCount());
+    }
+
+private:
+    Scope(const Scope &);
+    Scope &operator=(const Scope &);
+
+    const char *_name;
+    int _id;
+    bool _on; // enabled() when the scope was entered
+    int64 _start;
+};
+}
+
+#ifdef KCF_TRACE
+#define KCF_TRACE_CONCAT_(a, b) a##b
+#define KCF_TRACE_CONCAT(a, b) KCF_TRACE_CONCAT_(a, b)
+#define KCF_TRACE_SCOPE(name) Trace::Scope KCF_TRACE_CONCAT(_trace_scope_, __LINE__)(name)
+#define KCF_TRACE_SCOPE_ID(name, id) Trace::Scope KCF_TRACE_CONCAT(_trace_scope_, __LINE__)(name, id)
+#define KCF_TRACE_COUNTER(name, id, value) do { if (Trace::enabled()) Trace::counter(name, id, value); } while (0)
+#else
+#define KCF_TRACE_SCOPE(name)
+#define KCF_TRACE_SCOPE_ID(name, id)
+#define KCF_TRACE_COUNTER(name, id, value) do { } while (0)
+#endif
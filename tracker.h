@@ -18,7 +18,8 @@
 
 #pragma once
 
-#include <opencv2/opencv.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <string>
 
 class Tracker
@@ -0,0 +1,76 @@
+#include "updatepolicy.hpp"
+
+UpdatePolicyParams::UpdatePolicyParams()
+    : enabled(false), min_psr(2.5f), min_apce_ratio(0.4f), stable_psr(3.5f), stable_motion(1.0f),
+      max_train_interval(5), max_untrained_interval(15), skip_after(3), skip_motion(0.5f), max_skip(1)
+{
+}
+
+UpdatePolicy::UpdatePolicy()
+{
+    reset();
+    resetDecisions();
+}
+
+void UpdatePolicy::reset()
+{
+    _apce_mean = 0;
+    _apce_frames = 0;
+    _since_train = 0;
+    _stable_frames = 0;
+    _skips_left = 0;
+}
+
+bool UpdatePolicy::skipDetection()
+{
+    if (!params.enabled || _skips_left <= 0)
+        return false;
+    _skips_left--;
+    _since_train++;
+    _decisions[UPDATE_SKIP]++;
+    return true;
+}
+
+UpdateDecision UpdatePolicy::decide(float psr, float apce, float motion)
+{
+    UpdateDecision decision = UPDATE_TRAIN;
+    if (params.enabled)
+    {
+        bool reliable = psr >= params.min_psr && (_apce_frames == 0 || apce >= params.min_apce_ratio * _apce_mean);
+        bool stable = reliable && psr >= params.stable_psr && motion < params.stable_motion;
+        // an unreliable target still trains now and then, or its model never recovers
+        bool overdue = params.max_untrained_interval > 0 && _since_train + 1 >= params.max_untrained_interval;
+        if ((!reliable && !overdue) || (stable && _since_train + 1 < params.max_train_interval))
+            decision = UPDATE_DETECT_ONLY;
+
+        // a run of stable frames that hardly moved: the next detections can be skipped
+        _stable_frames = stable && motion < params.skip_motion ? _stable_frames + 1 : 0;
+        // every further stable detection arms the skips again, a moving one stops them
+        if (params.skip_after > 0 && _stable_frames >= params.skip_after)
+            _skips_left = params.max_skip;
+    }
+
+    if (decision == UPDATE_TRAIN)
+    {
+        _since_train = 0;
+        _apce_frames++;
+        _apce_mean += (apce - _apce_mean) / _apce_frames;
+    }
+    else
+    {
+        _since_train++;
+    }
+    _decisions[decision]++;
+    return decision;
+}
+
+const int *UpdatePolicy::decisions() const
+{
+    return _decisions;
+}
+
+void UpdatePolicy::resetDecisions()
+{
+    for (int i = 0; i < UPDATE_DECISIONS; i++)
+        _decisions[i] = 0;
+}
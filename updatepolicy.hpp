@@ -0,0 +1,98 @@
+/*
+
+Per-target decision between training, detection only and no detection at all.
+
+By default a KCFTracker detects on every frame and trains its model on every
+accepted detection. Training is as expensive as a detection, and on frames where
+the target neither moves nor changes it adds nothing to the model; on frames
+where the response is weak (partial occlusion, blur) it even corrupts it. An
+enabled UpdatePolicy looks at every accepted detection and decides:
+
+    UPDATE_TRAIN        train as usual
+    UPDATE_DETECT_ONLY  keep the position, leave the model as it is: the response
+                        is unreliable (PSR below min_psr or APCE below
+                        min_apce_ratio times its mean over the trained frames),
+                        or the frame is stable (PSR above stable_psr, target moved
+                        less than stable_motion pixels) and the model was trained
+                        less than max_train_interval frames ago
+    UPDATE_SKIP         skip the detection of the next frames altogether (at most
+                        max_skip in a row), after skip_after stable frames in a
+                        row that moved less than skip_motion pixels
+
+max_train_interval bounds the drift of a model left alone on stable frames: a
+reliable frame trains at the latest after that many frames. max_untrained_interval
+does the same for a target whose responses stay unreliable, so a long partial
+occlusion or a lasting change of appearance cannot freeze its model for good.
+A skipped frame keeps the target where it was, so skip_motion must stay well
+below the search window.
+
+The PSR of this tracker is low compared to the usual MOSSE figures: the central
+part responseStats() leaves out of the sidelobe is small, so the sidelobe keeps
+most of the slope of the peak. The detection checks in KCFTracker::update()
+put their PSR gates between 2.3 and 2.5, min_psr and stable_psr default to
+that range.
+
+decisions() counts every decision of the target. Disabled (the default), the
+policy always answers UPDATE_TRAIN and the tracker behaves as without it.
+
+ */
+
+#pragma once
+
+#ifndef _UPDATEPOLICY_HPP_
+#define _UPDATEPOLICY_HPP_
+#endif
+
+enum UpdateDecision
+{
+    UPDATE_TRAIN = 0,
+    UPDATE_DETECT_ONLY,
+    UPDATE_SKIP,
+    UPDATE_DECISIONS
+};
+
+struct UpdatePolicyParams
+{
+    bool enabled;
+    float min_psr;          // no training below this PSR
+    float min_apce_ratio;   // no training below this fraction of the mean APCE of the trained frames
+    float stable_psr;       // a frame is stable from this PSR...
+    float stable_motion;    // ...when the target moved less than this, in pixels
+    int max_train_interval; // frames without training after which a reliable frame trains anyway
+    int max_untrained_interval; // frames without training after which any accepted frame trains, 0 never
+    int skip_after;         // stable frames in a row before detections are skipped, 0 never skips
+    float skip_motion;      // largest motion of these frames, in pixels
+    int max_skip;           // frames skipped in a row
+
+    UpdatePolicyParams();
+};
+
+class UpdatePolicy
+{
+public:
+    UpdatePolicy();
+
+    UpdatePolicyParams params;
+
+    // Start over, keeping params and the counters
+    void reset();
+
+    // Before the detection of a frame: true to skip it, the target keeps its position
+    bool skipDetection();
+
+    // After an accepted detection: what to do with it. motion is the displacement of the
+    // target since the previous frame, in pixels.
+    UpdateDecision decide(float psr, float apce, float motion);
+
+    // Decisions taken so far, by UpdateDecision
+    const int *decisions() const;
+    void resetDecisions();
+
+private:
+    double _apce_mean;     // mean APCE of the trained frames
+    int _apce_frames;
+    int _since_train;      // frames since the last training
+    int _stable_frames;    // stable low-motion frames in a row
+    int _skips_left;
+    int _decisions[UPDATE_DECISIONS];
+};